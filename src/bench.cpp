@@ -1,7 +1,17 @@
 #include "bench.hpp"
+#include "chess/movegen.hpp"
+#include "misc/memory.hpp"
 #include "misc/utils.hpp"
+#include "nnue/format.hpp"
 #include "search/search.hpp"
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
 namespace jet {
 
     const std::array<std::string, 50> bench_fens = {
@@ -85,4 +95,313 @@ namespace jet {
         std::cout << std::flush;
     }
 
+    // Positions outside the bench that evalcheck also goes through: more than 32 pieces, past the last output
+    // bucket of a legal position
+    static const std::array<std::string, 2> evalcheck_fens = {
+        "rnbqkbnr/pppppppp/pppppppp/8/8/8/PPPPPPPP/RNBQKBNR w - - 0 1",
+        "rnbqkbnr/pppppppp/pppppppp/pppppppp/PPPPPPPP/PPPPPPPP/PPPPPPPP/RNBQKBNR b - - 0 1",
+    };
+
+    // Goes through the refresh, the incremental update and the king refresh paths of the accumulator
+    static std::vector<int32_t> collectEvals(search::SearchThread& st) {
+        std::vector<int32_t>     evals;
+        std::vector<std::string> fens(bench_fens.begin(), bench_fens.end());
+
+        fens.insert(fens.end(), evalcheck_fens.begin(), evalcheck_fens.end());
+
+        for (const auto& fen : fens) {
+            st.setFen(fen);
+            evals.push_back(st.eval());
+
+            chess::Movelist movelist;
+            chess::MoveGen::legalmoves<chess::MoveGenType::ALL>(st.board(), movelist);
+
+            for (int i = 0; i < movelist.size(); i++) {
+                st.makeMove<true>(movelist[i]);
+                evals.push_back(st.eval());
+                st.unmakeMove<true>(movelist[i]);
+            }
+        }
+
+        return evals;
+    }
+
+    // A SCReLU network whose QA times an output weight overflows int16 would make the vector kernels disagree
+    // with the scalar ones, so the loader has to refuse it
+    static bool refusesScreluOverflow() {
+        constexpr size_t hidden = 256;
+
+        const size_t payload = nnue::format::payloadBytes(hidden, 1);
+        const size_t weights = nnue::format::weightBytes(nnue::constants::WeightType::INT16) *
+                               nnue::constants::INPUT_SIZE * hidden + sizeof(int16_t) * hidden;
+
+        std::vector<uint8_t> data(sizeof(nnue::format::NetHeader) + payload);
+        auto*                hiddenWeights = data.data() + sizeof(nnue::format::NetHeader) + weights;
+
+        for (size_t i = 0; i < 2 * hidden; i++) {
+            const int16_t weight = i % 2 ? 400 : -400;
+            std::memcpy(hiddenWeights + i * sizeof(int16_t), &weight, sizeof(weight));
+        }
+
+        nnue::format::NetHeader header{};
+        header.magic      = nnue::format::MAGIC;
+        header.hash       = nnue::format::hash(data.data() + sizeof(header), payload);
+        header.version    = nnue::format::VERSION;
+        header.inputs     = nnue::constants::INPUT_SIZE;
+        header.buckets    = nnue::constants::BUCKETS;
+        header.hidden     = hidden;
+        header.outputs    = 1;
+        header.qa         = 255;
+        header.qb         = 64;
+        header.activation = static_cast<uint32_t>(nnue::constants::Activation::SCRELU);
+
+        std::memcpy(data.data(), &header, sizeof(header));
+
+        misc::LargePageMemory file;
+        file.borrow(data.data(), data.size());
+
+        std::string error;
+        const bool  refused = !nnue::check(std::move(file), error);
+
+        std::cout << "info string SCReLU network with QA 255 and weights of 400: "
+                  << (refused ? "refused, " + error : "accepted") << std::endl;
+
+        return refused;
+    }
+
+    bool EvalCheck() {
+        using nnue::simd::Isa;
+
+        // A thread state of its own, so the position and accumulators of the caller stay as they are
+        misc::LargePageObject<search::SearchThread> heapSt;
+
+        auto&      st       = heapSt.create(misc::NumaPolicy::LOCAL);
+        const auto selected = nnue::simd::selected;
+        const auto best     = static_cast<int>(nnue::simd::detect());
+
+        std::vector<int32_t> reference;
+        bool                 exact = true;
+
+        for (int isa = static_cast<int>(Isa::SCALAR); isa <= best; isa++) {
+            nnue::simd::use(static_cast<Isa>(isa));
+            st.rebuildNetwork();
+
+            const auto evals = collectEvals(st);
+
+            if (reference.empty()) {
+                reference = evals;
+                continue;
+            }
+
+            int mismatches = 0;
+
+            for (size_t i = 0; i < evals.size(); i++) {
+                mismatches += evals[i] != reference[i];
+            }
+
+            exact = exact && mismatches == 0;
+
+            std::cout << "info string " << nnue::simd::isaName(static_cast<Isa>(isa)) << ": " << evals.size()
+                      << " evals, " << mismatches << " differ from scalar" << std::endl;
+        }
+
+        nnue::simd::use(selected);
+
+        std::cout << "info string Evals " << (exact ? "match" : "do not match") << " the scalar kernels" << std::endl;
+
+        // A bucket past the last one would read output weights behind the network
+        bool inRange = true;
+
+        for (const auto& fen : evalcheck_fens) {
+            const chess::Board board(fen);
+
+            inRange = inRange && nnue::parameters.outputBucket(board) < nnue::parameters.outputs;
+        }
+
+        std::cout << "info string Output buckets of positions with more than 32 pieces are "
+                  << (inRange ? "in range" : "out of range") << std::endl;
+
+        const bool refused = refusesScreluOverflow();
+        const bool intact  = nnue::intact();
+
+        std::cout << "info string Network weights " << (intact ? "match" : "do not match") << " their hash"
+                  << std::endl;
+
+        return exact && inRange && refused && intact;
+    }
+
+    // Whether setFen can read a line: a placement of 8 ranks of 8 squares with one king per side, the side to
+    // move, the castling rights and the en passant square, split the way setFen splits them. Move counters
+    // are optional.
+    static bool isFen(std::string_view line) {
+        while (!line.empty() && line.front() == ' ') {
+            line.remove_prefix(1);
+        }
+
+        const auto fields = misc::splitString(line, ' ');
+
+        if (fields.size() < 4) {
+            return false;
+        }
+
+        const std::string_view placement = fields[0], side = fields[1], castling = fields[2], enPassant = fields[3];
+
+        int ranks = 1, files = 0, whiteKings = 0, blackKings = 0;
+
+        for (const char c : placement) {
+            if (c == '/') {
+                if (files != 8) {
+                    return false;
+                }
+
+                ranks++;
+                files = 0;
+            } else if (c >= '1' && c <= '8') {
+                files += c - '0';
+            } else if (std::string_view("pnbrqkPNBRQK").find(c) != std::string_view::npos) {
+                files++;
+                whiteKings += c == 'K';
+                blackKings += c == 'k';
+            } else {
+                return false;
+            }
+
+            if (files > 8) {
+                return false;
+            }
+        }
+
+        if (ranks != 8 || files != 8 || whiteKings != 1 || blackKings != 1) {
+            return false;
+        }
+
+        if (side != "w" && side != "b") {
+            return false;
+        }
+
+        if (castling != "-") {
+            if (castling.empty() || castling.size() > 4) {
+                return false;
+            }
+
+            for (size_t i = 0; i < castling.size(); i++) {
+                if (std::string_view("KQkq").find(castling[i]) == std::string_view::npos ||
+                    castling.find(castling[i], i + 1) != std::string_view::npos) {
+                    return false;
+                }
+            }
+        }
+
+        return enPassant == "-" || (enPassant.size() == 2 && enPassant[0] >= 'a' && enPassant[0] <= 'h' &&
+                                    (enPassant[1] == '3' || enPassant[1] == '6'));
+    }
+
+    bool EvalBatch(const std::string& input, const std::string& output, int threads) {
+        // Lines read at a time, and lines a worker takes at a time. A block is sorted by king placement before it
+        // is evaluated, so bigger blocks share more refresh cache entries between their positions.
+        static constexpr size_t CHUNK = 1 << 16;
+        static constexpr size_t BLOCK = 1 << 10;
+
+        std::ifstream in(input);
+        std::ofstream out(output);
+
+        if (!in || !out) {
+            std::cout << "info string Could not open " << (in ? output : input) << std::endl;
+            return false;
+        }
+
+        std::vector<std::string> lines;
+        std::vector<int32_t>     scores(CHUNK);
+        std::vector<uint8_t>     valid(CHUNK);
+        size_t                   total     = 0;
+        size_t                   read      = 0;
+        size_t                   skipped   = 0;
+        size_t                   firstSkip = 0;
+
+        const auto start = misc::tick();
+
+        threads = std::max(threads, 1);
+
+        while (true) {
+            lines.clear();
+
+            for (std::string line; lines.size() < CHUNK && std::getline(in, line);) {
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+
+                lines.push_back(std::move(line));
+            }
+
+            if (lines.empty()) {
+                break;
+            }
+
+            std::atomic<size_t> next{0};
+
+            const auto work = [&]() {
+                nnue::Network             network;
+                std::vector<chess::Board> boards(BLOCK);
+                std::vector<int32_t>      blockScores(BLOCK);
+                std::vector<size_t>       indices(BLOCK);
+
+                for (size_t begin; (begin = next.fetch_add(BLOCK)) < lines.size();) {
+                    const size_t end   = std::min(begin + BLOCK, lines.size());
+                    size_t       count = 0;
+
+                    for (size_t i = begin; i < end; i++) {
+                        valid[i] = !lines[i].empty() && isFen(lines[i]);
+
+                        if (valid[i]) {
+                            boards[count].setFen(lines[i]);
+                            indices[count++] = i;
+                        }
+                    }
+
+                    network.evaluate(boards.data(), blockScores.data(), count);
+
+                    for (size_t i = 0; i < count; i++) {
+                        scores[indices[i]] = blockScores[i];
+                    }
+                }
+            };
+
+            std::vector<std::thread> workers;
+
+            for (int i = 0; i < std::min<int>(threads, (lines.size() + BLOCK - 1) / BLOCK); i++) {
+                workers.emplace_back(work);
+            }
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            // Lines that are not a FEN stay empty in the output, like empty lines, so the lines still match up
+            for (size_t i = 0; i < lines.size(); i++) {
+                if (valid[i]) {
+                    out << scores[i];
+                    total++;
+                } else if (!lines[i].empty() && skipped++ == 0) {
+                    firstSkip = read + i + 1;
+                }
+
+                out << '\n';
+            }
+
+            read += lines.size();
+        }
+
+        const auto elapsed = misc::tick() - start;
+
+        std::cout << "info string Evaluated " << total << " positions in " << elapsed << " ms, "
+                  << static_cast<uint64_t>(1000.0 * total / (elapsed + 1)) << " per second" << std::endl;
+
+        if (skipped) {
+            std::cout << "info string Skipped " << skipped << " lines that are not a FEN, the first is line "
+                      << firstSkip << std::endl;
+        }
+
+        return static_cast<bool>(out);
+    }
+
 } // namespace jet
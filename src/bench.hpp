@@ -6,4 +6,12 @@ namespace jet {
 
     void StartBenchmark(search::SearchThread& st);
 
+    // Evaluates the bench positions and every position one legal move away from them with the NNUE kernels of each
+    // instruction set this CPU supports. Returns false if any eval differs from the scalar kernels'.
+    bool EvalCheck();
+
+    // Writes the static eval of every FEN line in input to the same line of output, from the side to move's point
+    // of view. Lines are read in chunks and evaluated by `threads` workers, each with its own network state.
+    bool EvalBatch(const std::string& input, const std::string& output, int threads);
+
 } // namespace jet
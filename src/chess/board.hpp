@@ -234,6 +234,31 @@ namespace chess {
             return m_hash;
         }
 
+        // Hash of the position after a move, without making it. Castling rights and the new en passant
+        // square are not tracked, so this is only exact for most moves. Good enough for prefetching.
+        U64 keyAfter(const Move& move) const {
+            const Piece piece    = movedPiece(move);
+            const Piece captured = capturedPiece(move);
+
+            U64 key = m_hash ^ Zobrist::sideKey();
+
+            if (m_enPassantSq.isValid()) {
+                key ^= Zobrist::enpassantKey(m_enPassantSq.file());
+            }
+
+            if (captured != Piece::NONE) {
+                key ^= Zobrist::pieceKey(captured, move.to());
+            }
+
+            if (move.type() == MoveType::ENPASSANT) {
+                key ^= Zobrist::pieceKey(makePiece(~m_sideToMove, PieceType::PAWN), Square(int(move.to()) ^ 8));
+            }
+
+            const Piece placed = move.type() == MoveType::PROMOTION ? makePiece(m_sideToMove, move.promoted()) : piece;
+
+            return key ^ Zobrist::pieceKey(piece, move.from()) ^ Zobrist::pieceKey(placed, move.to());
+        }
+
         constexpr U64 genHash() const {
             U64 hash_key = 0;
 
@@ -451,6 +476,8 @@ namespace chess {
             m_halfmoveClock = 0;
 
             removePiece(captured_piece, move.to());
+
+            m_hash ^= Zobrist::pieceKey(captured_piece, move.to());
         }
 
         if (is_capture && pieceToPieceType(captured_piece) == PieceType::ROOK && Square::isTheirBackRank(move.to(), side)) {
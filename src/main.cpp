@@ -2,6 +2,7 @@
 #include "chess/movegen.hpp"
 #include "chess/zobrist.hpp"
 #include "evaluation/evaluate.hpp"
+#include "misc/memory.hpp"
 #include "nnue/nnue.hpp"
 #include "perfsuite.hpp"
 #include "search/search.hpp"
@@ -12,6 +13,7 @@
 #include <istream>
 #include <memory>
 #include <sstream>
+#include <thread>
 #include <type_traits>
 
 using namespace chess;
@@ -96,9 +98,27 @@ int main(int argc, char** argv) {
     std::cout << "Copyright (C) 2023  " << AUTHOR << std::endl;
     search::TranspositionTable.initialize<false>(16);
 
-    auto   heapSt = std::make_unique<SearchThread>();
-    auto&  st     = *heapSt;
-    Board& board  = st.board();
+    std::cout << "info string Hash uses " << misc::pageKindName(search::TranspositionTable.pageKind()) << ", network uses "
+              << misc::pageKindName(nnue::parameters.memory.kind()) << std::endl;
+    std::cout << "info string Network has " << nnue::parameters.hidden << " hidden neurons and "
+              << nnue::parameters.outputs << " output buckets"
+              << (nnue::parameters.weightType == nnue::constants::WeightType::INT8 ? " on int8 rows" : "")
+              << ", kernels use "
+              << nnue::simd::isaName(nnue::simd::selected) << std::endl;
+
+    // Search state goes on the NUMA node of the thread that searches with it
+    misc::LargePageObject<SearchThread> heapSt;
+
+    auto&  st    = heapSt.create(misc::NumaPolicy::LOCAL);
+    Board& board = st.board();
+
+    // Binding can fail, for example under a restrictive cpuset, the pages then stay wherever they are touched
+    if (misc::numa::nodeCount() > 1) {
+        std::cout << "info string Hash is " << (search::TranspositionTable.numaBound() ? "" : "not ")
+                  << "interleaved over " << misc::numa::nodeCount() << " NUMA nodes, search state is "
+                  << (heapSt.memory().numaBound() ? "" : "not ") << "bound to node " << misc::numa::currentNode()
+                  << std::endl;
+    }
 
     std::string line;
     std::string token;
@@ -111,6 +131,10 @@ int main(int argc, char** argv) {
         StartBenchmark(st);
         return 0;
     }
+
+    if (argc > 1 && std::string(argv[1]) == "evalcheck") {
+        return EvalCheck() ? 0 : 1;
+    }
     
     print_parameter_inputs(true);
 
@@ -135,12 +159,17 @@ int main(int argc, char** argv) {
             std::cout << "id author " << AUTHOR << std::endl;
             std::cout << "option name Hash type spin default 8 min 8 max 32768" << std::endl;
             std::cout << "option name Threads type spin default 1 min 1 max 1" << std::endl;
+            std::cout << "option name SharedHash type string default <empty>" << std::endl;
+            std::cout << "option name EvalFile type string default <embedded>" << std::endl;
             std::cout << "uciok" << std::endl;
         } else if (token == "isready") {
             std::cout << "readyok\n";
         } else if (token == "ucinewgame") {
-            // Re initialize the transposition table upon a new game
-            search::TranspositionTable.initialize<false>(16);
+            // Wipe the transposition table upon a new game, keeping the configured size. A shared table is
+            // left alone, other processes may still be using it.
+            if (!search::TranspositionTable.shared()) {
+                search::TranspositionTable.printClearTime(search::TranspositionTable.clear());
+            }
             st.setFen(FENS::STARTPOS);
         } else if (token == "movegen") {
             Movelist list;
@@ -161,6 +190,19 @@ int main(int argc, char** argv) {
         } else if (token == "bench"){
             StartBenchmark(st);
             exit(0);
+        } else if (token == "evalcheck") {
+            EvalCheck();
+        } else if (token == "evalbatch") {
+            std::string input;
+            std::string output;
+            int         threads = std::max<int>(1, std::thread::hardware_concurrency());
+            iss >> input >> output >> threads;
+
+            if (input.empty() || output.empty()) {
+                std::cout << "Usage: evalbatch <fen file> <output file> [threads]" << std::endl;
+            } else {
+                EvalBatch(input, output, threads);
+            }
         } else if (token == "position") {
             iss >> token;
 
@@ -298,9 +340,84 @@ int main(int argc, char** argv) {
                 iss >> token;
                 iss >> token;
                 search::TranspositionTable.initialize<true>(std::clamp(std::stoi(token), 8, 32768));
+            } else if (token == "SharedHash") {
+                std::string name;
+                iss >> token;
+                iss >> name;
+
+                if (name.empty() || name == "<empty>") {
+                    search::TranspositionTable.unshare();
+                    std::cout << "info string Hash is private" << std::endl;
+                } else if (search::TranspositionTable.share(name)) {
+                    std::cout << "info string Hash is shared as " << name << " with "
+                              << search::TranspositionTable.size() * TT::BUCKET_SIZE << " entries" << std::endl;
+                }
+            } else if (token == "EvalFile") {
+                std::string path;
+                std::string error;
+                iss >> token;
+                std::getline(iss >> std::ws, path);
+
+                const bool     embedded = path.empty() || path == "<embedded>";
+                const uint64_t previous = nnue::parameters.hash;
+
+                if (embedded ? nnue::loadEmbedded(error) : nnue::loadFile(path, error)) {
+                    st.rebuildNetwork();
+                    std::cout << "info string Loaded " << (embedded ? "embedded network" : path) << " with "
+                              << nnue::parameters.hidden << " hidden neurons from "
+                              << misc::pageKindName(nnue::parameters.memory.kind()) << std::endl;
+
+                    // The static evals cached in the hash came from the old network. A shared table is left to the
+                    // processes still running that network, and this one goes back to a private table.
+                    if (nnue::parameters.hash != previous) {
+                        if (search::TranspositionTable.shared()) {
+                            search::TranspositionTable.unshare();
+                            std::cout << "info string Hash is private, the shared table uses the old network"
+                                      << std::endl;
+                        } else {
+                            search::TranspositionTable.printClearTime(search::TranspositionTable.clear());
+                        }
+                    }
+                } else {
+                    std::cout << "info string Network not changed, " << error << std::endl;
+                }
             }
 
             search::init();
+        } else if (token == "savehash" || token == "loadhash") {
+            std::string path;
+            iss >> path;
+
+            if (path.empty()) {
+                std::cout << "Usage: " << token << " <file>" << std::endl;
+            } else if (token == "savehash") {
+                const bool ok = search::TranspositionTable.save(path);
+                std::cout << "info string " << (ok ? "Saved hash to " : "Could not save hash to ") << path << std::endl;
+            } else if (search::TranspositionTable.load(path)) {
+                std::cout << "info string Loaded " << search::TranspositionTable.size() * TT::BUCKET_SIZE
+                          << " hash entries from " << path << std::endl;
+            }
+        } else if (token == "exportnet") {
+            std::string path;
+            std::string type;
+            size_t      clipped = 0;
+            iss >> path >> type;
+
+            const bool int8 = type == "int8";
+
+            if (path.empty() || !(type.empty() || int8 || type == "int16")) {
+                std::cout << "Usage: exportnet <file> [int16|int8]" << std::endl;
+            } else if (!nnue::intact()) {
+                std::cout << "info string Loaded network does not match its hash, not exporting it" << std::endl;
+            } else if (nnue::save(path, int8 ? nnue::constants::WeightType::INT8 : nnue::constants::WeightType::INT16,
+                                  clipped)) {
+                std::cout << "info string Saved network to " << path << ", " << clipped
+                          << " feature weights saturated to int8" << std::endl;
+            } else {
+                std::cout << "info string Could not save network to " << path << std::endl;
+            }
+        } else if (token == "ttstats") {
+            search::TranspositionTable.printStats();
         } else if (token == "print") {
             std::cout << board << std::endl;
             st.refresh();
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include "numa.hpp"
+
+#if defined(__linux__)
+#    include <cerrno>
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace misc {
+
+    enum class PageKind : uint8_t {
+        NONE,
+        NORMAL,      // regular 4 KB pages
+        TRANSPARENT, // madvise(MADV_HUGEPAGE), the kernel may back it with 2 MB pages
+        HUGETLB,     // explicit MAP_HUGETLB pages
+        FILE,        // private copy-on-write mapping of a file
+        SHARED,      // named POSIX shared memory, visible to other processes
+        EMBEDDED,    // data linked into the executable, borrowed and never freed
+    };
+
+    inline const char* pageKindName(PageKind kind) {
+        switch (kind) {
+            case PageKind::HUGETLB:
+                return "huge pages (MAP_HUGETLB)";
+            case PageKind::TRANSPARENT:
+                return "transparent huge pages";
+            case PageKind::NORMAL:
+                return "normal pages";
+            case PageKind::FILE:
+                return "a file mapping";
+            case PageKind::SHARED:
+                return "shared memory";
+            case PageKind::EMBEDDED:
+                return "the data embedded in the binary";
+            default:
+                return "not allocated";
+        }
+    }
+
+    // Zero-initialized, 2 MB aligned memory that tries to sit on huge pages to cut dTLB misses.
+    // Falls back to transparent huge pages and then to ordinary pages, whatever the system allows.
+    class LargePageMemory {
+    public:
+        static constexpr inline size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        LargePageMemory() = default;
+
+        LargePageMemory(const LargePageMemory&)            = delete;
+        LargePageMemory& operator=(const LargePageMemory&) = delete;
+
+        LargePageMemory(LargePageMemory&& other) noexcept {
+            *this = std::move(other);
+        }
+
+        LargePageMemory& operator=(LargePageMemory&& other) noexcept {
+            if (this != &other) {
+                release();
+                std::swap(m_data, other.m_data);
+                std::swap(m_size, other.m_size);
+                std::swap(m_mapped, other.m_mapped);
+                std::swap(m_kind, other.m_kind);
+                std::swap(m_numa, other.m_numa);
+                std::swap(m_inode, other.m_inode);
+            }
+            return *this;
+        }
+
+        ~LargePageMemory() {
+            release();
+        }
+
+        // Returns false if no memory at all could be obtained. The NUMA policy is set before any page is touched.
+        bool allocate(size_t bytes, NumaPolicy policy = NumaPolicy::FIRST_TOUCH) {
+            release();
+
+            if (bytes == 0) {
+                return true;
+            }
+
+            const size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+#if defined(__linux__)
+#    if defined(MAP_HUGETLB)
+            void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (ptr != MAP_FAILED) {
+                m_data   = ptr;
+                m_size   = size;
+                m_mapped = size;
+                m_kind   = PageKind::HUGETLB;
+                m_numa   = numa::bind(m_data, m_size, policy);
+                return true;
+            }
+#    endif
+
+            // Over-allocate so the region can be trimmed to a 2 MB boundary, THP only backs aligned ranges
+            const size_t mapped = size + HUGE_PAGE_SIZE;
+            void*        raw    = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (raw != MAP_FAILED) {
+                const auto address = reinterpret_cast<uintptr_t>(raw);
+                const auto aligned = (address + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+                const auto head    = aligned - address;
+                const auto tail    = mapped - head - size;
+
+                if (head) {
+                    munmap(raw, head);
+                }
+
+                if (tail) {
+                    munmap(reinterpret_cast<void*>(aligned + size), tail);
+                }
+
+                m_data   = reinterpret_cast<void*>(aligned);
+                m_size   = size;
+                m_mapped = size;
+                m_kind   = PageKind::NORMAL;
+                m_numa   = numa::bind(m_data, m_size, policy);
+
+#    if defined(MADV_HUGEPAGE)
+                if (madvise(m_data, m_size, MADV_HUGEPAGE) == 0) {
+                    m_kind = PageKind::TRANSPARENT;
+                }
+#    endif
+                return true;
+            }
+#endif
+
+            (void) policy;
+
+            m_data = ::operator new(size, std::align_val_t(HUGE_PAGE_SIZE), std::nothrow);
+
+            if (!m_data) {
+                return false;
+            }
+
+            std::memset(m_data, 0, size);
+            m_size = size;
+            m_kind = PageKind::NORMAL;
+            return true;
+        }
+
+        // Maps a whole file copy-on-write. Pages are faulted in from the page cache on first use and
+        // writes never reach the file, so even a huge file is usable right away. A read-only mapping is
+        // never copied, every process mapping the file shares the same page cache pages. Without mmap the
+        // file is read into ordinary memory instead.
+        bool mapFile(const char* path, bool writable = true) {
+            release();
+
+#if defined(__linux__)
+            const int fd = open(path, O_RDONLY);
+
+            if (fd < 0) {
+                return false;
+            }
+
+            struct stat st;
+
+            if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+                close(fd);
+                return false;
+            }
+
+            const size_t size = static_cast<size_t>(st.st_size);
+            void*        ptr  = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+
+            if (ptr == MAP_FAILED) {
+                return false;
+            }
+
+            // Start reading ahead in the background, the search does not have to wait for it
+            madvise(ptr, size, MADV_WILLNEED);
+
+            m_data   = ptr;
+            m_size   = size;
+            m_mapped = size;
+            m_kind   = PageKind::FILE;
+            return true;
+#else
+            FILE* file = std::fopen(path, "rb");
+
+            if (!file) {
+                return false;
+            }
+
+            std::fseek(file, 0, SEEK_END);
+            const long size = std::ftell(file);
+            std::fseek(file, 0, SEEK_SET);
+
+            const bool ok = size > 0 && allocate(size) && std::fread(m_data, 1, size, file) == static_cast<size_t>(size);
+            std::fclose(file);
+
+            if (!ok) {
+                release();
+                return false;
+            }
+
+            m_size = size;
+            return true;
+#endif
+        }
+
+        // Maps the POSIX shared memory object `name` (a leading '/' and no other slashes). If it does not
+        // exist yet it is created with `bytes` of zeroed memory and `created` is set, otherwise the existing
+        // object is mapped at whatever size its creator gave it. Unmapping never removes the object, see
+        // unlinkShared().
+        bool mapShared(const char* name, size_t bytes, bool& created) {
+            release();
+            created = false;
+
+#if defined(__linux__)
+            int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+            if (fd >= 0) {
+                created = true;
+
+                if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+                    close(fd);
+                    shm_unlink(name);
+                    return false;
+                }
+            } else if (errno == EEXIST) {
+                fd = shm_open(name, O_RDWR, 0600);
+            }
+
+            if (fd < 0) {
+                return false;
+            }
+
+            // The creator sizes the object right after creating it, wait for that to land
+            struct stat st;
+            int         tries = 0;
+
+            while (fstat(fd, &st) == 0 && st.st_size == 0 && tries++ < 1000) {
+                usleep(1000);
+            }
+
+            if (st.st_size <= 0) {
+                close(fd);
+                return false;
+            }
+
+            const size_t size = static_cast<size_t>(st.st_size);
+            void*        ptr  = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (ptr == MAP_FAILED) {
+                if (created) {
+                    shm_unlink(name);
+                }
+                return false;
+            }
+
+#    if defined(MADV_HUGEPAGE)
+            madvise(ptr, size, MADV_HUGEPAGE);
+#    endif
+
+            m_data   = ptr;
+            m_size   = size;
+            m_mapped = size;
+            m_kind   = PageKind::SHARED;
+            m_inode  = static_cast<uint64_t>(st.st_ino);
+            return true;
+#else
+            (void) name;
+            (void) bytes;
+            return false;
+#endif
+        }
+
+        // Removes `name` if it still refers to the shared memory object mapped here, and not to a newer one
+        // created under the same name since. Processes that still map the object keep their mapping.
+        void unlinkShared(const char* name) const {
+#if defined(__linux__)
+            const int fd = shm_open(name, O_RDONLY, 0);
+
+            if (fd < 0) {
+                return;
+            }
+
+            struct stat st;
+            const bool  same = m_kind == PageKind::SHARED && fstat(fd, &st) == 0 &&
+                              static_cast<uint64_t>(st.st_ino) == m_inode;
+            close(fd);
+
+            if (same) {
+                shm_unlink(name);
+            }
+#else
+            (void) name;
+#endif
+        }
+
+        // Wraps memory this object does not own, such as data linked into the executable. It must not be
+        // written to.
+        void borrow(const void* data, size_t size) {
+            release();
+
+            m_data = const_cast<void*>(data);
+            m_size = size;
+            m_kind = PageKind::EMBEDDED;
+        }
+
+        void release() {
+            if (!m_data) {
+                return;
+            }
+
+            // Borrowed memory is not ours to free
+            if (m_kind != PageKind::EMBEDDED) {
+#if defined(__linux__)
+                if (m_mapped) {
+                    munmap(m_data, m_mapped);
+                } else
+#endif
+                {
+                    ::operator delete(m_data, std::align_val_t(HUGE_PAGE_SIZE));
+                }
+            }
+
+            m_data   = nullptr;
+            m_size   = 0;
+            m_mapped = 0;
+            m_kind   = PageKind::NONE;
+            m_numa   = false;
+            m_inode  = 0;
+        }
+
+        void* data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+
+        PageKind kind() const {
+            return m_kind;
+        }
+
+        // True if the pages follow a NUMA policy other than first touch
+        bool numaBound() const {
+            return m_numa;
+        }
+
+    private:
+        void*    m_data   = nullptr;
+        size_t   m_size   = 0;
+        size_t   m_mapped = 0;
+        PageKind m_kind   = PageKind::NONE;
+        bool     m_numa   = false;
+        uint64_t m_inode  = 0; // of a shared memory object, see unlinkShared()
+    };
+
+    // Fixed size array of trivially copyable T living in a LargePageMemory block
+    template <typename T, size_t N>
+    class LargePageArray {
+    public:
+        LargePageArray() = default;
+
+        bool allocate(NumaPolicy policy = NumaPolicy::FIRST_TOUCH) {
+            return m_memory.allocate(sizeof(T) * N, policy);
+        }
+
+        T* data() {
+            return static_cast<T*>(m_memory.data());
+        }
+
+        const T* data() const {
+            return static_cast<const T*>(m_memory.data());
+        }
+
+        T& operator[](size_t i) {
+            return data()[i];
+        }
+
+        const T& operator[](size_t i) const {
+            return data()[i];
+        }
+
+        static constexpr size_t size() {
+            return N;
+        }
+
+        const LargePageMemory& memory() const {
+            return m_memory;
+        }
+
+    private:
+        LargePageMemory m_memory;
+    };
+
+    // Owns a single T constructed in a LargePageMemory block, used to place per-thread state on a NUMA node
+    template <typename T>
+    class LargePageObject {
+    public:
+        LargePageObject() = default;
+
+        LargePageObject(const LargePageObject&)            = delete;
+        LargePageObject& operator=(const LargePageObject&) = delete;
+
+        ~LargePageObject() {
+            reset();
+        }
+
+        template <typename... Args>
+        T& create(NumaPolicy policy, Args&&... args) {
+            reset();
+
+            if (!m_memory.allocate(sizeof(T), policy)) {
+                throw std::bad_alloc();
+            }
+
+            m_object = new (m_memory.data()) T(std::forward<Args>(args)...);
+            return *m_object;
+        }
+
+        void reset() {
+            if (m_object) {
+                m_object->~T();
+                m_object = nullptr;
+            }
+
+            m_memory.release();
+        }
+
+        T& operator*() const {
+            return *m_object;
+        }
+
+        T* operator->() const {
+            return m_object;
+        }
+
+        const LargePageMemory& memory() const {
+            return m_memory;
+        }
+
+    private:
+        LargePageMemory m_memory;
+        T*              m_object = nullptr;
+    };
+
+} // namespace misc
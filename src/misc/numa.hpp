@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#if defined(__linux__)
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+namespace misc {
+
+    // Where the pages of a fresh allocation should live on a NUMA machine
+    enum class NumaPolicy : uint8_t {
+        FIRST_TOUCH, // kernel default, a page lands on the node of the thread that first writes it
+        INTERLEAVE,  // pages round-robin over all nodes, for memory every thread hits at random (the TT)
+        LOCAL,       // pages prefer the node of the allocating thread, for per-thread state
+    };
+
+    // Thin wrappers around the Linux mbind/getcpu syscalls, so no libnuma is needed at build or run time.
+    // Everything quietly does nothing on single node machines, other systems or kernels without NUMA support.
+    namespace numa {
+
+        // Values from <linux/mempolicy.h>
+        static constexpr inline int MPOL_PREFERRED_  = 1;
+        static constexpr inline int MPOL_INTERLEAVE_ = 3;
+
+        // One word of node mask is plenty for any machine we run on
+        static constexpr inline int MAX_NODES = 64;
+
+        // Number of NUMA nodes the kernel reports online, 1 if unknown
+        inline int nodeCount() {
+            static const int count = []() {
+                std::ifstream file("/sys/devices/system/node/online");
+                std::string   list;
+
+                if (!(file >> list)) {
+                    return 1;
+                }
+
+                // The list looks like "0", "0-1" or "0,2-3", the highest node id is at the end
+                const auto last = list.find_last_of(",-");
+                const int  high = std::stoi(last == std::string::npos ? list : list.substr(last + 1));
+
+                return std::clamp(high + 1, 1, MAX_NODES);
+            }();
+
+            return count;
+        }
+
+        // Node of the CPU the calling thread runs on right now
+        inline int currentNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+            unsigned cpu  = 0;
+            unsigned node = 0;
+
+            if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+                return static_cast<int>(node);
+            }
+#endif
+            return 0;
+        }
+
+        // Sets the policy of a page aligned range that has not been touched yet. Returns true if the kernel took it.
+        inline bool bind(void* ptr, size_t size, NumaPolicy policy) {
+#if defined(__linux__) && defined(SYS_mbind)
+            if (policy == NumaPolicy::FIRST_TOUCH || nodeCount() < 2) {
+                return false;
+            }
+
+            unsigned long mask = 0;
+            int           mode = 0;
+
+            if (policy == NumaPolicy::INTERLEAVE) {
+                mode = MPOL_INTERLEAVE_;
+                mask = nodeCount() == MAX_NODES ? ~0UL : (1UL << nodeCount()) - 1;
+            } else {
+                mode = MPOL_PREFERRED_;
+                mask = 1UL << std::min(currentNode(), MAX_NODES - 1);
+            }
+
+            // maxnode counts one past the last bit the kernel should read
+            return syscall(SYS_mbind, ptr, size, mode, &mask, MAX_NODES + 1, 0) == 0;
+#else
+            (void) ptr;
+            (void) size;
+            (void) policy;
+            return false;
+#endif
+        }
+
+    } // namespace numa
+
+} // namespace misc
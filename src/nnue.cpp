@@ -1,6 +1,11 @@
 #include "nnue/nnue.hpp"
+#include "nnue/format.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
+#include <iostream>
+#include <vector>
 
 #define INCBIN_STYLE INCBIN_STYLE_CAMEL
 #include "incbin/incbin.h"
@@ -9,31 +14,242 @@ INCBIN(EVAL, NNFILE);
 namespace jet {
     namespace nnue {
 
-        std::array<int16_t, constants::INPUT_LAYER_SIZE> inputWeights;
-        std::array<int16_t, constants::HIDDEN_SIZE>      inputBias;
-        std::array<int16_t, constants::HIDDEN_SIZE * 2>  hiddenWeights;
-        std::array<int32_t, constants::OUTPUT_SIZE>      hiddenBias;
+        Parameters parameters;
 
-        template<typename T, size_t SIZE>
-        void copyDataFromMemory(std::array<T, SIZE>& dataArray, uint64_t& memoryIndex) {
-            constexpr auto size = sizeof(T) * SIZE;
-            std::memcpy(dataArray.data(), &gEVALData[memoryIndex], size);
-            memoryIndex += size;
+        namespace {
+
+            // Checks a header against what this build can run, returns an empty string if it is fine
+            std::string validate(const format::NetHeader& header, size_t payload) {
+                const auto& sizes = constants::HIDDEN_SIZES;
+
+                if (header.version != format::VERSION) {
+                    return "unsupported network version " + std::to_string(header.version);
+                }
+
+                if (header.inputs != constants::INPUT_SIZE || header.buckets != constants::BUCKETS) {
+                    return "network has " + std::to_string(header.inputs) + " inputs in " +
+                           std::to_string(header.buckets) + " king buckets, expected " +
+                           std::to_string(constants::INPUT_SIZE) + " in " + std::to_string(constants::BUCKETS);
+                }
+
+                if (std::find(sizes.begin(), sizes.end(), static_cast<int>(header.hidden)) == sizes.end()) {
+                    return "unsupported hidden size " + std::to_string(header.hidden);
+                }
+
+                if (header.outputs < 1 || header.outputs > static_cast<uint32_t>(constants::MAX_OUTPUT_BUCKETS)) {
+                    return "unsupported output bucket count " + std::to_string(header.outputs);
+                }
+
+                if (header.activation >= constants::ACTIVATIONS) {
+                    return "unknown activation " + std::to_string(header.activation);
+                }
+
+                if (header.weightType >= constants::WEIGHT_TYPES) {
+                    return "unknown weight type " + std::to_string(header.weightType);
+                }
+
+                // The clip must fit the int16 kernels, the SCReLU weights are checked against it once they are placed
+                if (header.qa <= 0 || header.qa > INT16_MAX || header.qb <= 0) {
+                    return "invalid quantization " + std::to_string(header.qa) + "/" + std::to_string(header.qb);
+                }
+
+                const auto   type     = static_cast<constants::WeightType>(header.weightType);
+                const size_t expected = format::payloadBytes(header.hidden, header.outputs, type);
+
+                if (payload != expected) {
+                    return "network payload is " + std::to_string(payload) + " bytes, expected " +
+                           std::to_string(expected);
+                }
+
+                return {};
+            }
+
+            // Everything load() does short of replacing the loaded network
+            bool prepare(misc::LargePageMemory&& file, Parameters& loaded, std::string& error) {
+                const auto*       data   = static_cast<const uint8_t*>(file.data());
+                size_t            size   = file.size();
+                format::NetHeader header{};
+
+                if (format::hasMagic(data, size)) {
+                    std::memcpy(&header, data, sizeof(header));
+
+                    data += sizeof(header);
+                    size -= sizeof(header);
+
+                    error = validate(header, size);
+
+                    if (!error.empty()) {
+                        return false;
+                    }
+                } else if (size ==
+                           format::payloadBytes(constants::LEGACY_HIDDEN_SIZE, constants::LEGACY_OUTPUT_BUCKETS)) {
+                    header.hidden     = constants::LEGACY_HIDDEN_SIZE;
+                    header.outputs    = constants::LEGACY_OUTPUT_BUCKETS;
+                    header.qa         = constants::LEGACY_INPUT_QUANTIZATION;
+                    header.qb         = constants::LEGACY_HIDDEN_QUANTIZATON;
+                    header.activation = static_cast<uint32_t>(constants::LEGACY_ACTIVATION);
+
+                    // Legacy files have no hash to name them by, the hash tables tag their evals with it
+                    header.hash = format::hash(data, size);
+                } else {
+                    error = "network has no header and is not the size of a legacy network";
+                    return false;
+                }
+
+                // Weights are only ever read, so a file mapping or the embedded data is used where it is, shared
+                // with every other process using the same file. Only a payload the kernels would load across cache
+                // lines is copied, into memory that tries to sit on huge pages.
+                misc::LargePageMemory memory;
+
+                if (reinterpret_cast<uintptr_t>(data) % simd::vectorBytes(simd::selected) == 0) {
+                    memory = std::move(file);
+                } else {
+                    if (!memory.allocate(size)) {
+                        throw std::bad_alloc();
+                    }
+
+                    std::memcpy(memory.data(), data, size);
+                    data = static_cast<const uint8_t*>(memory.data());
+                }
+
+                const size_t hidden  = header.hidden;
+                const size_t outputs = header.outputs;
+                const auto   type    = static_cast<constants::WeightType>(header.weightType);
+                const size_t rows    = format::weightBytes(type) * constants::INPUT_SIZE * hidden;
+
+                loaded.hidden     = static_cast<int>(hidden);
+                loaded.outputs    = static_cast<int>(outputs);
+                loaded.qa         = static_cast<int16_t>(header.qa);
+                loaded.qb         = header.qb;
+                loaded.activation = static_cast<constants::Activation>(header.activation);
+                loaded.weightType = type;
+                loaded.hash       = header.hash;
+
+                loaded.inputWeights  = data;
+                loaded.inputBias     = reinterpret_cast<const int16_t*>(data + rows);
+                loaded.hiddenWeights = loaded.inputBias + hidden;
+                loaded.hiddenBias    = reinterpret_cast<const int32_t*>(loaded.hiddenWeights + outputs * 2 * hidden);
+
+                if (loaded.activation == constants::Activation::SCRELU &&
+                    !simd::fitsScrelu(loaded.hiddenWeights, outputs * 2 * hidden, loaded.qa)) {
+                    error = "SCReLU network has output weights above " + std::to_string(INT16_MAX / header.qa) +
+                            " in magnitude, QA times a weight must fit in int16";
+                    return false;
+                }
+
+                loaded.memory = std::move(memory);
+
+                return true;
+            }
+
+        } // namespace
+
+        bool load(misc::LargePageMemory&& file, std::string& error) {
+            Parameters loaded;
+
+            if (!prepare(std::move(file), loaded, error)) {
+                return false;
+            }
+
+            parameters = std::move(loaded);
+
+            return true;
+        }
+
+        bool check(misc::LargePageMemory&& file, std::string& error) {
+            Parameters loaded;
+
+            return prepare(std::move(file), loaded, error);
+        }
+
+        bool intact() {
+            const size_t payload = format::payloadBytes(parameters.hidden, parameters.outputs, parameters.weightType);
+
+            return format::hash(static_cast<const uint8_t*>(parameters.inputWeights), payload) == parameters.hash;
+        }
+
+        bool loadEmbedded(std::string& error) {
+            misc::LargePageMemory file;
+            file.borrow(gEVALData, gEVALSize);
+
+            return load(std::move(file), error);
+        }
+
+        bool loadFile(const std::string& path, std::string& error) {
+            misc::LargePageMemory file;
+
+            if (!file.mapFile(path.c_str(), false)) {
+                error = "could not open " + path;
+                return false;
+            }
+
+            return load(std::move(file), error);
+        }
+
+        bool save(const std::string& path, constants::WeightType type, size_t& clipped) {
+            const size_t rows    = static_cast<size_t>(constants::INPUT_SIZE) * parameters.hidden;
+            const size_t payload = format::payloadBytes(parameters.hidden, parameters.outputs, type);
+            const size_t rest    = payload - format::weightBytes(type) * rows;
+
+            std::vector<uint8_t> data(payload);
+
+            clipped = 0;
+
+            // Rows in the requested type, then everything from the input bias on as it is
+            for (size_t i = 0; i < rows; i++) {
+                const int16_t value = parameters.weightType == constants::WeightType::INT8
+                                          ? static_cast<const int8_t*>(parameters.inputWeights)[i]
+                                          : static_cast<const int16_t*>(parameters.inputWeights)[i];
+
+                if (type == constants::WeightType::INT8) {
+                    const int8_t narrow = static_cast<int8_t>(std::clamp<int16_t>(value, INT8_MIN, INT8_MAX));
+
+                    clipped += narrow != value;
+                    data[i] = static_cast<uint8_t>(narrow);
+                } else {
+                    std::memcpy(&data[i * sizeof(int16_t)], &value, sizeof(int16_t));
+                }
+            }
+
+            std::memcpy(&data[payload - rest], parameters.inputBias, rest);
+
+            format::NetHeader header{};
+            header.magic      = format::MAGIC;
+            header.hash       = format::hash(data.data(), payload);
+            header.version    = format::VERSION;
+            header.inputs     = constants::INPUT_SIZE;
+            header.buckets    = constants::BUCKETS;
+            header.hidden     = parameters.hidden;
+            header.outputs    = parameters.outputs;
+            header.qa         = parameters.qa;
+            header.qb         = parameters.qb;
+            header.activation = static_cast<uint32_t>(parameters.activation);
+            header.weightType = static_cast<uint32_t>(type);
+
+            std::ofstream file(path, std::ios::binary);
+
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(data.data()), payload);
+
+            return static_cast<bool>(file);
         }
 
         void init() {
-            uint64_t memoryIndex = 0;
+            std::string error;
+
+            simd::init();
 
-            copyDataFromMemory(inputWeights, memoryIndex);
-            copyDataFromMemory(inputBias, memoryIndex);
-            copyDataFromMemory(hiddenWeights, memoryIndex);
-            copyDataFromMemory(hiddenBias, memoryIndex);
+            if (!loadEmbedded(error)) {
+                std::cout << "info string Embedded network is unusable: " << error << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
 
 #ifdef DEBUG
-            std::cout << "Memory index: " << memoryIndex << std::endl;
+            std::cout << "Network: " << parameters.hidden << " hidden, " << parameters.outputs << " outputs, QA "
+                      << parameters.qa << ", QB " << parameters.qb << std::endl;
             std::cout << "Size: " << gEVALSize << std::endl;
 #endif
         }
 
     } // namespace nnue
-} // namespace jet
\ No newline at end of file
+} // namespace jet
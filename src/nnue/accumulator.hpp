@@ -2,23 +2,44 @@
 
 #include <array>
 #include <cstdint>
+#include <type_traits>
 
+#include "simd.hpp"
 #include "types.hpp"
 
 namespace jet {
 
     namespace nnue {
 
-        enum class AccumulatorOP : uint8_t {
-            ADD,
-            SUB,
-            ADD_SUB,
+        struct DirtyPiece {
+            chess::PieceType pieceType;
+            chess::Color     color;
+            chess::Square    square;
         };
 
-        template <typename T>
+        // Pieces a move takes off and puts on the board. Castling touches the most, two of each.
+        struct AccumulatorUpdate {
+            std::array<DirtyPiece, 2> added;
+            std::array<DirtyPiece, 2> removed;
+            int                       adds = 0;
+            int                       subs = 0;
+
+            void add(chess::PieceType pieceType, chess::Color color, chess::Square square) {
+                added[adds++] = {pieceType, color, square};
+            }
+
+            void sub(chess::PieceType pieceType, chess::Color color, chess::Square square) {
+                removed[subs++] = {pieceType, color, square};
+            }
+        };
+
+        // T accumulates rows of W, int8 rows are widened by the kernels
+        template <typename T, int Size, typename W = T>
         class AccumulatorBase {
+            static_assert(std::is_same_v<T, int16_t>, "accumulators are updated by the int16 kernels, see simd.hpp");
+
         private:
-            using Weights = std::array<T, constants::HIDDEN_SIZE>;
+            using Weights = std::array<T, Size>;
 
             // 0 = white POV, 1 = black POV
             std::array<Weights, 2> weights;
@@ -26,44 +47,57 @@ namespace jet {
         public:
             AccumulatorBase() = default;
 
-            void load(const Weights& bias) {
-                std::memcpy(weights[0].data(), bias.data(), sizeof(Weights));
-                std::memcpy(weights[1].data(), bias.data(), sizeof(Weights));
-            }
-
+            // Sets one perspective to the parent's plus the added rows minus the removed rows, in a single pass
             template <chess::Color c>
-            void add(const T* input) {
-                for (int i = 0; i < constants::HIDDEN_SIZE; ++i) {
-                    weights[static_cast<int>(c)][i] += input[i];
+            void update(const AccumulatorBase& parent, const std::array<const W*, 2>& adds, int addCount,
+                        const std::array<const W*, 2>& subs, int subCount) {
+                T*       out = weights[static_cast<int>(c)].data();
+                const T* in  = parent.weights[static_cast<int>(c)].data();
+
+                if (addCount == 1 && subCount == 1) {
+                    simd::kernels<Size, W>.copyAddSub(out, in, adds[0], subs[0]);
+                    return;
                 }
-            }
 
-            template <chess::Color c>
-            void sub(const T* input) {
-                for (int i = 0; i < constants::HIDDEN_SIZE; ++i) {
-                    weights[static_cast<int>(c)][i] -= input[i];
+                if (addCount == 1 && subCount == 2) {
+                    simd::kernels<Size, W>.copyAddSubSub(out, in, adds[0], subs[0], subs[1]);
+                    return;
+                }
+
+                if (addCount == 2 && subCount == 2) {
+                    simd::kernels<Size, W>.copyAddAddSubSub(out, in, adds[0], adds[1], subs[0], subs[1]);
+                    return;
+                }
+
+                for (int i = 0; i < Size; ++i) {
+                    T value = in[i];
+
+                    for (int j = 0; j < addCount; j++) {
+                        value += adds[j][i];
+                    }
+
+                    for (int j = 0; j < subCount; j++) {
+                        value -= subs[j][i];
+                    }
+
+                    out[i] = value;
                 }
             }
 
+            // Overwrites one perspective, used when a refresh is served from the refresh cache
             template <chess::Color c>
-            void addSub(const T* inputAdd, const T* inputSub) {
-                for (int i = 0; i < constants::HIDDEN_SIZE; ++i) {
-                    weights[static_cast<int>(c)][i] += inputAdd[i] - inputSub[i];
-                }
+            void load(const Weights& values) {
+                std::memcpy(weights[static_cast<int>(c)].data(), values.data(), sizeof(Weights));
             }
 
             template <chess::Color c>
             const auto& data() const {
                 return weights[static_cast<int>(c)];
             }
-
-            void copy(const AccumulatorBase& other) {
-                std::memcpy(weights[0].data(), other.weights[0].data(), sizeof(Weights));
-                std::memcpy(weights[1].data(), other.weights[1].data(), sizeof(Weights));
-            }
         };
 
-        using Accumulator = AccumulatorBase<int16_t>;
+        template <int Size, typename W = int16_t>
+        using Accumulator = AccumulatorBase<int16_t, Size, W>;
 
     } // namespace nnue
 
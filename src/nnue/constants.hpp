@@ -1,4 +1,7 @@
+#pragma once
+
 #include <array>
+#include <cstdint>
 
 namespace jet {
     namespace nnue {
@@ -7,15 +10,32 @@ namespace jet {
 
             constexpr int BUCKETS     = 16;
             constexpr int INPUT_SIZE  = 64 * 6 * 2 * BUCKETS;
-            constexpr int HIDDEN_SIZE = 512;
-            constexpr int OUTPUT_SIZE = 1;
 
-            constexpr int INPUT_LAYER_SIZE  = INPUT_SIZE * HIDDEN_SIZE;
-            constexpr int HIDDEN_LAYER_SIZE = HIDDEN_SIZE * 2;
-            constexpr int OUTPUT_LAYER_SIZE = OUTPUT_SIZE;
+            // Output buckets a network file may have. The bucket of a position is picked by its piece count, so
+            // openings and bare endgames each get their own output weights.
+            constexpr int MAX_OUTPUT_BUCKETS = 8;
+
+            // Hidden sizes a network file may use, each one gets its own Network and kernel instantiation
+            constexpr std::array<int, 3> HIDDEN_SIZES = {256, 512, 768};
+
+            // Activation between the accumulator and the output layer. CReLU and SCReLU clip to [0, QA],
+            // SCReLU squares the clipped value.
+            enum class Activation : uint8_t { RELU, CRELU, SCRELU };
+
+            constexpr int ACTIVATIONS = 3;
+
+            // Storage of the feature transformer rows. INT8 halves the bytes every accumulator update streams in,
+            // the rows are widened to the int16 accumulators as they are loaded.
+            enum class WeightType : uint8_t { INT16, INT8 };
+
+            constexpr int WEIGHT_TYPES = 2;
 
-            constexpr int INPUT_QUANTIZATION = 32;
-            constexpr int HIDDEN_QUANTIZATON = 128;
+            // Architecture of headerless network files, which predate the self-describing format
+            constexpr int        LEGACY_HIDDEN_SIZE        = 512;
+            constexpr int        LEGACY_OUTPUT_BUCKETS     = 1;
+            constexpr int        LEGACY_INPUT_QUANTIZATION = 32;
+            constexpr int        LEGACY_HIDDEN_QUANTIZATON = 128;
+            constexpr Activation LEGACY_ACTIVATION         = Activation::RELU;
 
             // clang-format off
             constexpr std::array<int, 64> KING_BUCKET {
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "constants.hpp"
+
+namespace jet {
+
+    namespace nnue {
+
+        // Network file layout, all little endian:
+        //
+        //   NetHeader      64 bytes, describes the architecture the payload was trained for
+        //   inputWeights   int16 or int8[INPUT_SIZE * hidden], see NetHeader::weightType
+        //   inputBias      int16[hidden]
+        //   hiddenWeights  int16[outputs][2 * hidden]
+        //   hiddenBias     int32[outputs]
+        //
+        // Files without a header are the legacy format, accepted only with the exact payload size of the
+        // architecture in constants::LEGACY_*.
+        namespace format {
+
+            static constexpr inline std::array<char, 8> MAGIC   = {'J', 'E', 'T', 'N', 'N', 'U', 'E', '\0'};
+            static constexpr inline uint32_t            VERSION = 1;
+
+            struct NetHeader {
+                std::array<char, 8>     magic;
+                uint64_t                hash;    // format::hash() of the payload
+                uint32_t                version;
+                uint32_t                inputs;  // constants::INPUT_SIZE
+                uint32_t                buckets; // constants::BUCKETS
+                uint32_t                hidden;  // one of constants::HIDDEN_SIZES
+                uint32_t                outputs; // output buckets, at most constants::MAX_OUTPUT_BUCKETS
+                int32_t                 qa;
+                int32_t                 qb;
+                uint32_t                activation; // constants::Activation
+                uint32_t                weightType; // constants::WeightType, zero (int16) in older files
+                std::array<uint32_t, 3> reserved;   // zero, keeps the payload 64 byte aligned
+            };
+
+            static_assert(sizeof(NetHeader) == 64, "the header must match the file layout");
+
+            inline size_t weightBytes(constants::WeightType type) {
+                return type == constants::WeightType::INT8 ? sizeof(int8_t) : sizeof(int16_t);
+            }
+
+            inline size_t payloadBytes(size_t hidden, size_t outputs,
+                                       constants::WeightType type = constants::WeightType::INT16) {
+                return weightBytes(type) * constants::INPUT_SIZE * hidden +
+                       sizeof(int16_t) * (hidden + outputs * 2 * hidden) + sizeof(int32_t) * outputs;
+            }
+
+            // FNV-1a 64 over whole 64-bit words and then the trailing bytes, so hashing a network costs a few
+            // milliseconds instead of a multiply per byte
+            inline uint64_t hash(const uint8_t* data, size_t size) {
+                uint64_t h = 0xcbf29ce484222325ULL;
+                size_t   i = 0;
+
+                for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+                    uint64_t word;
+                    std::memcpy(&word, data + i, sizeof(word));
+
+                    h = (h ^ word) * 0x100000001b3ULL;
+                }
+
+                for (; i < size; i++) {
+                    h = (h ^ data[i]) * 0x100000001b3ULL;
+                }
+
+                return h;
+            }
+
+            inline bool hasMagic(const uint8_t* data, size_t size) {
+                return size >= sizeof(NetHeader) && std::memcmp(data, MAGIC.data(), MAGIC.size()) == 0;
+            }
+
+        } // namespace format
+
+    } // namespace nnue
+
+} // namespace jet
@@ -1,8 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <cstdint>
-
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "../chess/board.hpp"
+#include "../misc/memory.hpp"
 #include "accumulator.hpp"
 #include "types.hpp"
 
@@ -10,33 +19,244 @@ namespace jet {
 
     namespace nnue {
 
+        // The loaded network: its architecture from the file header and the weights, which all live in one
+        // allocation. Every pointer has `hidden` as its row length, the output layer has one row pair and one bias
+        // per output bucket. inputWeights holds int16 or int8 values, as weightType says.
+        struct Parameters {
+            int                   hidden     = 0;
+            int                   outputs    = 1;
+            int16_t               qa         = 0;
+            int32_t               qb         = 0;
+            constants::Activation activation = constants::Activation::RELU;
+            constants::WeightType weightType = constants::WeightType::INT16;
+            uint64_t              hash       = 0;
+
+            misc::LargePageMemory memory;
+
+            const void*    inputWeights  = nullptr;
+            const int16_t* inputBias     = nullptr;
+            const int16_t* hiddenWeights = nullptr;
+            const int32_t* hiddenBias    = nullptr;
+
+            // Splits the 2 to 32 pieces of a legal position evenly over the output buckets. Boards with more
+            // pieces, which a FEN can still describe, share the last bucket.
+            int outputBucket(const chess::Board& board) const {
+                const int piecesPerBucket = (32 + outputs - 1) / outputs;
+                return std::min((board.occupied().popcount() - 2) / piecesPerBucket, outputs - 1);
+            }
+        };
+
+        extern Parameters parameters;
+
         void init();
 
-        extern std::array<int16_t, constants::INPUT_LAYER_SIZE> inputWeights;
-        extern std::array<int16_t, constants::HIDDEN_SIZE>      inputBias;
-        extern std::array<int16_t, constants::HIDDEN_SIZE * 2>  hiddenWeights;
-        extern std::array<int32_t, constants::OUTPUT_SIZE>      hiddenBias;
+        // Validates a network file (header or legacy) and makes it the loaded network, taking over its memory.
+        // On failure the loaded network is left alone and `error` says why. Every Network must be rebuilt after
+        // a successful load.
+        bool load(misc::LargePageMemory&& file, std::string& error);
 
-        class Network {
+        // Runs every check of load() on a network file without loading it
+        bool check(misc::LargePageMemory&& file, std::string& error);
+
+        // Whether the loaded weights still hash to the value in their header. Loading trusts the header, so only
+        // evalcheck and exportnet pay for reading the whole payload.
+        bool intact();
+
+        // The network linked into the binary
+        bool loadEmbedded(std::string& error);
+
+        // A network file, mapped read-only
+        bool loadFile(const std::string& path, std::string& error);
+
+        // Writes the loaded network with a header, which also converts a legacy file to the current format.
+        // Int16 feature transformer rows are stored as `type`. Rows that do not fit int8 are saturated, `clipped`
+        // returns how many values were.
+        bool save(const std::string& path, constants::WeightType type, size_t& clipped);
+
+        template <int Size, typename W>
+        class NetworkBase {
         private:
-            std::array<Accumulator, 512> accumulatorStack;
+            static constexpr inline int STACK_SIZE = 512;
+
+            // What turns the parent accumulator into this one, recorded by push() and applied by eval()
+            struct DirtyDelta {
+                AccumulatorUpdate update;
+                chess::Square     kingSqWhite;
+                chess::Square     kingSqBlack;
+                bool              computed = false;
+            };
+
+            // Refresh cache ("Finny table"): for each perspective, king bucket and mirror half, the accumulator of
+            // the last position refreshed there and the pieces it was built from. A refresh starts from that entry
+            // and only applies the pieces that changed since, instead of adding every piece to the bias.
+            struct RefreshEntry {
+                std::array<int16_t, Size>                      accumulator;
+                std::array<std::array<chess::Bitboard, 6>, 2> pieces;
+            };
+
+            static constexpr inline int REFRESH_ENTRIES = 2 * constants::BUCKETS * 2;
+
+            misc::LargePageArray<Accumulator<Size, W>, STACK_SIZE> accumulatorStack;
+            misc::LargePageArray<RefreshEntry, REFRESH_ENTRIES>    refreshCache;
+            std::array<DirtyDelta, STACK_SIZE>                     deltas;
 
             int currentAccumulator = 0;
 
-            static int16_t ReLU(int16_t x) {
-                return std::max(x, static_cast<int16_t>(0));
+            // Feature transformer row of one input
+            static const W* row(int input) {
+                return static_cast<const W*>(parameters.inputWeights) + static_cast<size_t>(input) * Size;
+            }
+
+            template <chess::Color side>
+            void pushPerspective(Accumulator<Size, W>& child, const Accumulator<Size, W>& parent,
+                                 const AccumulatorUpdate& update, chess::Square kingSq) {
+                std::array<const W*, 2> adds;
+                std::array<const W*, 2> subs;
+
+                for (int i = 0; i < update.adds; i++) {
+                    const auto& piece = update.added[i];
+                    adds[i]           = row(index<side>(piece.pieceType, piece.color, piece.square, kingSq));
+                }
+
+                for (int i = 0; i < update.subs; i++) {
+                    const auto& piece = update.removed[i];
+                    subs[i]           = row(index<side>(piece.pieceType, piece.color, piece.square, kingSq));
+                }
+
+                child.template update<side>(parent, adds, update.adds, subs, update.subs);
+            }
+
+            // Brings the accumulator of `target` up to date, starting from the last one that was computed
+            void materialize(int target) {
+                int ply = target;
+
+                while (ply > 0 && !deltas[ply].computed) {
+                    ply--;
+                }
+
+                for (ply++; ply <= target; ply++) {
+                    const auto& delta  = deltas[ply];
+                    const auto& parent = accumulatorStack[ply - 1];
+                    auto&       child  = accumulatorStack[ply];
+
+                    pushPerspective<chess::Color::WHITE>(child, parent, delta.update, delta.kingSqWhite);
+                    pushPerspective<chess::Color::BLACK>(child, parent, delta.update, delta.kingSqBlack);
+
+                    deltas[ply].computed = true;
+                }
+            }
+
+            template <chess::Color side>
+            static int refreshIndex(chess::Square kingSq) {
+                const int mirror = !!(kingSq & 0x4);
+                return (static_cast<int>(side) * constants::BUCKETS + kingSquareIndex(kingSq, side)) * 2 + mirror;
+            }
+
+            template <chess::Color side>
+            RefreshEntry& refreshEntry(chess::Square kingSq) {
+                return refreshCache[refreshIndex<side>(kingSq)];
+            }
+
+            template <chess::Color side>
+            void refreshPerspective(const chess::Board& board) {
+                const auto kingSq = board.kingSq(side);
+                auto&      entry  = refreshEntry<side>(kingSq);
+
+                for (int c = 0; c < 2; c++) {
+                    for (int pt = 0; pt < 6; pt++) {
+                        const auto color     = static_cast<chess::Color>(c);
+                        const auto pieceType = static_cast<chess::PieceType>(pt);
+                        const auto current   = board.bitboard(color, pieceType);
+                        auto       added     = current & ~entry.pieces[c][pt];
+                        auto       removed   = entry.pieces[c][pt] & ~current;
+
+                        while (added.nonEmpty()) {
+                            const int inputs = index<side>(pieceType, color, added.poplsb(), kingSq);
+                            simd::kernels<Size, W>.add(entry.accumulator.data(), row(inputs));
+                        }
+
+                        while (removed.nonEmpty()) {
+                            const int inputs = index<side>(pieceType, color, removed.poplsb(), kingSq);
+                            simd::kernels<Size, W>.sub(entry.accumulator.data(), row(inputs));
+                        }
+
+                        entry.pieces[c][pt] = current;
+                    }
+                }
+
+                accumulatorStack[currentAccumulator].template load<side>(entry.accumulator);
+            }
+
+            template <chess::Color side>
+            void refreshAfterKingMove(const chess::Board& board) {
+                const auto& delta  = deltas[currentAccumulator];
+                const auto& parent = accumulatorStack[currentAccumulator - 1];
+                auto&       child  = accumulatorStack[currentAccumulator];
+
+                materialize(currentAccumulator - 1);
+
+                pushPerspective<~side>(child, parent, delta.update,
+                                       side == chess::Color::WHITE ? delta.kingSqBlack : delta.kingSqWhite);
+                refreshPerspective<side>(board);
+
+                deltas[currentAccumulator].computed = true;
             }
 
         public:
-            Network() = default;
+            static constexpr inline int HIDDEN = Size;
+            using Weight                       = W;
 
-            void resetCurrentAccumulator() {
-                accumulatorStack[currentAccumulator].load(inputBias);
+            NetworkBase() {
+                // The output kernel is picked by parameters.activation, the loader refuses SCReLU weights it would
+                // overflow on
+                assert(parameters.activation != constants::Activation::SCRELU ||
+                       simd::fitsScrelu(parameters.hiddenWeights, 2 * Size * parameters.outputs, parameters.qa));
+
+                if (!accumulatorStack.allocate(misc::NumaPolicy::LOCAL) || !refreshCache.allocate(misc::NumaPolicy::LOCAL)) {
+                    throw std::bad_alloc();
+                }
+
+                resetRefreshCache();
             }
 
-            void push() {
-                accumulatorStack[currentAccumulator + 1].copy(accumulatorStack[currentAccumulator]);
-                currentAccumulator++;
+            // Every cache entry starts as the empty board, must be called again whenever the weights change
+            void resetRefreshCache() {
+                for (int i = 0; i < REFRESH_ENTRIES; i++) {
+                    std::memcpy(refreshCache[i].accumulator.data(), parameters.inputBias, sizeof(int16_t) * Size);
+                    refreshCache[i].pieces      = {};
+                }
+            }
+
+            // Called right after push() for a move whose king changes the inputs of side's perspective. Only that
+            // perspective is rebuilt from the refresh cache, the other one is updated from the parent as usual.
+            void refresh(chess::Color side, const chess::Board& board) {
+                if (side == chess::Color::WHITE) {
+                    refreshAfterKingMove<chess::Color::WHITE>(board);
+                } else {
+                    refreshAfterKingMove<chess::Color::BLACK>(board);
+                }
+            }
+
+            // Rebuilds both perspectives of the current accumulator for the board from the refresh cache
+            void refresh(const chess::Board& board) {
+                refreshPerspective<chess::Color::WHITE>(board);
+                refreshPerspective<chess::Color::BLACK>(board);
+                deltas[currentAccumulator].computed = true;
+            }
+
+            // Records the move that leads to the child of the current accumulator. Nothing is computed until the
+            // child is evaluated, so nodes that return before their static eval never pay for the update.
+            // The caller fills in the returned update with the pieces the move takes off and puts on.
+            AccumulatorUpdate& push(chess::Square kingSqWhite, chess::Square kingSqBlack) {
+                auto& delta = deltas[++currentAccumulator];
+
+                delta.update.adds = 0;
+                delta.update.subs = 0;
+                delta.kingSqWhite = kingSqWhite;
+                delta.kingSqBlack = kingSqBlack;
+                delta.computed    = false;
+
+                return delta.update;
             }
 
             void pull() {
@@ -48,76 +268,120 @@ namespace jet {
             }
 
             template <chess::Color side>
-            int32_t eval() const {
+            int32_t eval(const chess::Board& board) {
+                materialize(currentAccumulator);
+
                 const auto& accumulator = accumulatorStack[currentAccumulator];
+                const int   bucket      = parameters.outputBucket(board);
 
-                int32_t output = hiddenBias[0];
+                int32_t output = simd::kernels<Size>.output[static_cast<int>(parameters.activation)](
+                    accumulator.template data<side>().data(), accumulator.template data<~side>().data(),
+                    parameters.hiddenWeights + bucket * 2 * Size, parameters.qa);
 
-                for (int i = 0; i < constants::HIDDEN_SIZE; ++i) {
-                    output += ReLU(accumulator.data<side>()[i]) * hiddenWeights[i];
+                if (parameters.activation == constants::Activation::SCRELU) {
+                    output /= parameters.qa;
                 }
 
-                for (int i = 0; i < constants::HIDDEN_SIZE; ++i) {
-                    output += ReLU(accumulator.data<~side>()[i]) * hiddenWeights[constants::HIDDEN_SIZE + i];
+                output += parameters.hiddenBias[bucket];
+
+                return output / parameters.qa / parameters.qb;
+            }
+
+            // Static evals of count unrelated boards, from each side to move's point of view. The boards are
+            // refreshed in the order of their refresh cache entries, so each refresh starts from an accumulator a
+            // few pieces away and reads weight rows the previous ones left in cache.
+            void evaluate(const chess::Board* boards, int32_t* scores, size_t count) {
+                std::vector<std::pair<int, uint32_t>> order(count);
+
+                for (size_t i = 0; i < count; i++) {
+                    const int white = refreshIndex<chess::Color::WHITE>(boards[i].kingSq<chess::Color::WHITE>());
+                    const int black = refreshIndex<chess::Color::BLACK>(boards[i].kingSq<chess::Color::BLACK>());
+
+                    order[i] = {white * REFRESH_ENTRIES + black, static_cast<uint32_t>(i)};
                 }
 
-                return output / constants::INPUT_QUANTIZATION / constants::HIDDEN_QUANTIZATON;
+                std::sort(order.begin(), order.end());
+
+                for (const auto& [entries, i] : order) {
+                    const auto& board = boards[i];
+
+                    reset();
+                    refresh(board);
+
+                    scores[i] = board.sideToMove() == chess::Color::WHITE ? eval<chess::Color::WHITE>(board)
+                                                                           : eval<chess::Color::BLACK>(board);
+                }
             }
+        };
+
+        // The search's view of the network. Holds the NetworkBase instantiation for the hidden size and weight type
+        // of the loaded file, picked once when the thread's state is built, so every call below is one predictable
+        // branch.
+        class Network {
+        private:
+            using Variant = std::variant<NetworkBase<256, int16_t>, NetworkBase<512, int16_t>,
+                                         NetworkBase<768, int16_t>, NetworkBase<256, int8_t>,
+                                         NetworkBase<512, int8_t>, NetworkBase<768, int8_t>>;
 
-            template <chess::Color side, AccumulatorOP operation>
-            void updateAccumulator(chess::PieceType pieceType, chess::Color pieceColor, chess::Square square,
-                                   chess::Square kingSq) {
-                static_assert(operation != AccumulatorOP::ADD_SUB,
-                              "This overloaded function isn't for add sub. Only add or sub.");
+            static_assert(std::variant_size_v<Variant> == constants::HIDDEN_SIZES.size() * constants::WEIGHT_TYPES,
+                          "one instantiation per supported hidden size and weight type");
 
-                auto&     accumulator = accumulatorStack[currentAccumulator];
-                const int inputs      = index<side>(pieceType, pieceColor, square, kingSq);
+            // Constructs the matching instantiation in place, load() only accepts sizes and types from the lists
+            template <size_t I = 0>
+            static Variant build() {
+                if constexpr (I + 1 < std::variant_size_v<Variant>) {
+                    using Base = std::variant_alternative_t<I, Variant>;
 
-                if constexpr (operation == AccumulatorOP::ADD) {
-                    accumulator.add<side>(inputWeights.data() + inputs * constants::HIDDEN_SIZE);
-                } else if constexpr (operation == AccumulatorOP::SUB) {
-                    accumulator.sub<side>(inputWeights.data() + inputs * constants::HIDDEN_SIZE);
+                    const auto type = std::is_same_v<typename Base::Weight, int8_t> ? constants::WeightType::INT8
+                                                                                    : constants::WeightType::INT16;
+
+                    if (Base::HIDDEN != parameters.hidden || type != parameters.weightType) {
+                        return build<I + 1>();
+                    }
                 }
+
+                return Variant{std::in_place_index<I>};
             }
 
-            template <chess::Color side, AccumulatorOP operation>
-            void updateAccumulator(chess::PieceType pieceType, chess::Color pieceColor, chess::Square from, chess::Square to,
-                                   chess::Square kingSq) {
-                static_assert(operation == AccumulatorOP::ADD_SUB,
-                              "This overloaded function isn't for add sub. Only add or sub.");
+            Variant network;
 
-                auto& accumulator = accumulatorStack[currentAccumulator];
+        public:
+            Network() : network{build()} {
+            }
 
-                const int inputsAdd = index<side>(pieceType, pieceColor, to, kingSq);
-                const int inputsSub = index<side>(pieceType, pieceColor, from, kingSq);
+            // Starts over with the loaded network, whose hidden size may differ
+            void rebuild() {
+                network = build();
+            }
 
-                accumulator.addSub<side>(inputWeights.data() + inputsAdd * constants::HIDDEN_SIZE,
-                                         inputWeights.data() + inputsSub * constants::HIDDEN_SIZE);
+            void refresh(chess::Color side, const chess::Board& board) {
+                std::visit([&](auto& net) { net.refresh(side, board); }, network);
             }
 
-            template <AccumulatorOP operation>
-            void updateAccumulator(chess::PieceType pieceType, chess::Color pieceColor, chess::Square square,
-                                   chess::Square kingSqWhite, chess::Square kingSqBlack) {
-                static_assert(operation != AccumulatorOP::ADD_SUB,
-                              "This overloaded function isn't for subbing or adding. Only add sub.");
+            void refresh(const chess::Board& board) {
+                std::visit([&](auto& net) { net.refresh(board); }, network);
+            }
 
-                if constexpr (operation == AccumulatorOP::ADD) {
-                    updateAccumulator<chess::Color::WHITE, AccumulatorOP::ADD>(pieceType, pieceColor, square, kingSqWhite);
-                    updateAccumulator<chess::Color::BLACK, AccumulatorOP::ADD>(pieceType, pieceColor, square, kingSqBlack);
-                } else if constexpr (operation == AccumulatorOP::SUB) {
-                    updateAccumulator<chess::Color::WHITE, AccumulatorOP::SUB>(pieceType, pieceColor, square, kingSqWhite);
-                    updateAccumulator<chess::Color::BLACK, AccumulatorOP::SUB>(pieceType, pieceColor, square, kingSqBlack);
-                }
+            AccumulatorUpdate& push(chess::Square kingSqWhite, chess::Square kingSqBlack) {
+                return std::visit(
+                    [&](auto& net) -> AccumulatorUpdate& { return net.push(kingSqWhite, kingSqBlack); }, network);
+            }
+
+            void pull() {
+                std::visit([](auto& net) { net.pull(); }, network);
             }
 
-            template <AccumulatorOP operation>
-            void updateAccumulator(chess::PieceType pieceType, chess::Color pieceColor, chess::Square from, chess::Square to,
-                                   chess::Square kingSqWhite, chess::Square kingSqBlack) {
-                static_assert(operation == AccumulatorOP::ADD_SUB,
-                              "This overloaded function isn't for subbing or adding. Only add sub.");
+            void reset() {
+                std::visit([](auto& net) { net.reset(); }, network);
+            }
+
+            template <chess::Color side>
+            int32_t eval(const chess::Board& board) {
+                return std::visit([&](auto& net) { return net.template eval<side>(board); }, network);
+            }
 
-                updateAccumulator<chess::Color::WHITE, AccumulatorOP::ADD_SUB>(pieceType, pieceColor, from, to, kingSqWhite);
-                updateAccumulator<chess::Color::BLACK, AccumulatorOP::ADD_SUB>(pieceType, pieceColor, from, to, kingSqBlack);
+            void evaluate(const chess::Board* boards, int32_t* scores, size_t count) {
+                std::visit([&](auto& net) { net.evaluate(boards, scores, count); }, network);
             }
         };
 
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "constants.hpp"
+
+namespace jet {
+
+    namespace nnue {
+
+        namespace simd {
+
+            enum class Isa : uint8_t {
+                SCALAR,
+                SSE41,
+                AVX2,
+                AVX512BW,
+                AVX512VNNI,
+            };
+
+            // Output layer dot product: the activated accumulator halves of the side to move and the other side
+            // against the two halves of the output weights, summed in int32. CReLU and SCReLU clip to `clip`, the
+            // network's QA. SCReLU sums are QA times larger than the others, as the clipped value is squared.
+            // The vector SCReLU kernels form clip * weight in int16, see fitsScrelu().
+            using OutputKernel = int32_t (*)(const int16_t* us, const int16_t* them, const int16_t* weights,
+                                             int16_t clip);
+
+            // Whether |clip * weight| fits in int16 for each of the count output weights, which the SCReLU kernels
+            // need to match the scalar ones. Networks that break it are refused when they are loaded.
+            bool fitsScrelu(const int16_t* weights, size_t count, int16_t clip);
+
+            // Accumulator update kernels over one perspective of Size int16 values, one table per supported hidden
+            // size and feature transformer row type (int16, or int8 widened as it is loaded). The tables are filled
+            // once by init() with the widest instruction set the CPU supports, so a binary built for a baseline
+            // x86-64 target still updates at full width on newer hosts.
+            template <int Size, typename Weight = int16_t>
+            struct Kernels {
+                void (*add)(int16_t* accumulator, const Weight* input);
+                void (*sub)(int16_t* accumulator, const Weight* input);
+
+                // Fused kernels for makeMove: read the parent once, apply every feature change of the move in
+                // registers and write the child once. Quiet moves and promotions, captures, castling.
+                void (*copyAddSub)(int16_t* child, const int16_t* parent, const Weight* add0, const Weight* sub0);
+                void (*copyAddSubSub)(int16_t* child, const int16_t* parent, const Weight* add0, const Weight* sub0,
+                                      const Weight* sub1);
+                void (*copyAddAddSubSub)(int16_t* child, const int16_t* parent, const Weight* add0, const Weight* add1,
+                                         const Weight* sub0, const Weight* sub1);
+
+                // One output kernel per constants::Activation
+                std::array<OutputKernel, constants::ACTIVATIONS> output;
+            };
+
+            // Empty until init() fills the tables of every size in constants::HIDDEN_SIZES
+            template <int Size, typename Weight = int16_t>
+            inline Kernels<Size, Weight> kernels{};
+
+            // Instruction set the tables were filled for
+            extern Isa selected;
+
+            // Picks the kernels from cpuid, called by nnue::init()
+            void init();
+
+            // Fills every table with the kernels of isa, which the CPU must support
+            void use(Isa isa);
+
+            // Best instruction set this CPU and OS support, regardless of what was compiled in
+            Isa detect();
+
+            const char* isaName(Isa isa);
+
+            // Width in bytes of the vectors the kernels of isa load, weights aligned to it never split a load
+            // over two cache lines
+            size_t vectorBytes(Isa isa);
+
+        } // namespace simd
+
+    } // namespace nnue
+
+} // namespace jet
@@ -66,24 +66,51 @@ namespace jet {
 
         template <NodeType nt>
         Value qsearch(Value alpha, Value beta, SearchThread& st) {
+            constexpr bool isPvNode = (nt == NodeType::PV || nt == NodeType::ROOT);
+            constexpr auto childNt  = isPvNode ? NodeType::PV : NodeType::NONPV;
+
             st.checkup();
 
-            Value bestscore = evaluation::evaluate(st);
+            Board& board = st.board();
+
+            bool       ttHit = false;
+            const auto entry = TranspositionTable.probe(board.hash(), ttHit);
+
+            if constexpr (!isPvNode) {
+                if (ttHit && entry.flag() != TT::Flag::NONE) {
+                    if ((entry.flag() == TT::Flag::UPPER && entry.score() <= alpha) ||
+                        (entry.flag() == TT::Flag::LOWER && entry.score() >= beta) || (entry.flag() == TT::Flag::EXACT)) {
+                        return entry.score();
+                    }
+                }
+            }
+
+            const Value staticEval =
+                ttHit && entry.eval() != constants::VALUE_NONE ? entry.eval() : evaluation::evaluate(st);
+
+            Value bestscore = staticEval;
 
             if (bestscore >= beta) {
+                if (!ttHit) {
+                    TranspositionTable.store(board.hash(), Move::none(), TT::DEPTH_QS, bestscore, staticEval,
+                                             TT::Flag::LOWER);
+                }
+
                 return bestscore;
             }
 
+            Value oldAlpha = alpha;
+
             if (bestscore > alpha) {
                 alpha = bestscore;
             }
 
-            Board&   board = st.board();
             Movelist movelist;
             MoveGen::legalmoves<MoveGenType::CAPTURE>(board, movelist);
-            MoveOrdering::capturesWithSee(board, movelist, qs_see_ordering_threshold);
+            MoveOrdering::capturesWithSee(board, movelist, qs_see_ordering_threshold, entry.move());
 
-            Value score = -constants::VALUE_INFINITY;
+            Value score    = -constants::VALUE_INFINITY;
+            Move  bestmove = Move::none();
 
             for (int i = 0; i < movelist.size(); i++) {
                 movelist.nextmove(i);
@@ -95,10 +122,12 @@ namespace jet {
                     break;
                 }
 
+                TranspositionTable.prefetch(board.keyAfter(move));
+
                 st.makeMove<true>(move);
                 st.nodes++;
 
-                score = -qsearch<NodeType::PV>(-beta, -alpha, st);
+                score = -qsearch<childNt>(-beta, -alpha, st);
 
                 st.unmakeMove<true>(move);
 
@@ -110,7 +139,8 @@ namespace jet {
                     bestscore = score;
 
                     if (score > alpha) {
-                        alpha = score;
+                        bestmove = move;
+                        alpha    = score;
 
                         if (score >= beta) {
                             break;
@@ -119,6 +149,11 @@ namespace jet {
                 }
             }
 
+            const TT::Flag flag = bestscore >= beta                         ? TT::Flag::LOWER
+                                  : (alpha != oldAlpha && bestmove != Move::none()) ? TT::Flag::EXACT
+                                                                                    : TT::Flag::UPPER;
+            TranspositionTable.store(board.hash(), bestmove, TT::DEPTH_QS, bestscore, staticEval, flag);
+
             return bestscore;
         }
 
@@ -147,8 +182,8 @@ namespace jet {
 
             constexpr bool isPvNode = (nt == NodeType::PV || nt == NodeType::ROOT);
 
-            bool        ttHit = false;
-            const auto& entry = TranspositionTable.probe(board.hash(), ttHit);
+            bool       ttHit = false;
+            const auto entry = TranspositionTable.probe(board.hash(), ttHit);
 
             if (ss->excluded.isValid()) {
                 ttHit = false;
@@ -169,14 +204,22 @@ namespace jet {
             depth += inCheck;
             if (inCheck || ss->excluded.isValid()) {
                 ss->static_eval = 0;
+            } else if (ttHit && entry.eval() != constants::VALUE_NONE) {
+                ss->static_eval = entry.eval();
             } else {
                 ss->static_eval = evaluation::evaluate(st);
+
+                // Even if the search never finishes here, the next visit can skip the network
+                if (!ttHit) {
+                    TranspositionTable.store(board.hash(), Move::none(), TT::DEPTH_EVAL, constants::VALUE_NONE,
+                                             ss->static_eval, TT::Flag::NONE);
+                }
             }
 
             Value eval = ss->static_eval;
 
             if constexpr (!isPvNode) {
-                if (ttHit) {
+                if (ttHit && entry.flag() != TT::Flag::NONE) {
                     eval = entry.score();
                 }
 
@@ -223,6 +266,12 @@ namespace jet {
             MoveGen::legalmoves<MoveGenType::ALL>(board, movelist);
             MoveOrdering::all(movelist, st, ss, entry.move());
 
+            if constexpr (TT::STATS) {
+                if (ttHit && entry.move() != Move::none() && movelist.find(entry.move()) == -1) {
+                    TranspositionTable.recordCollision();
+                }
+            }
+
             Movelist quietlist;
 
             Move  bestmove  = Move::none();
@@ -269,6 +318,9 @@ namespace jet {
 
                 Depth newDepth = depth + extension;
 
+                // Start loading the child's TT bucket while the accumulator gets updated
+                TranspositionTable.prefetch(board.keyAfter(move));
+
                 st.makeMove<true>(move);
                 (ss + 1)->ply = ss->ply + 1;
                 ss->move      = move;
@@ -357,7 +409,8 @@ namespace jet {
 
             if (!ss->excluded.isValid()) {
                 TT::Flag flag = bestscore >= beta ? TT::Flag::LOWER : (alpha != oldAlpha) ? TT::Flag::EXACT : TT::Flag::UPPER;
-                TranspositionTable.store(board.hash(), bestmove, depth, bestscore, flag);
+                TranspositionTable.store(board.hash(), bestmove, depth, bestscore,
+                                         inCheck ? constants::VALUE_NONE : ss->static_eval, flag);
             }
 
             return bestscore;
@@ -411,6 +464,7 @@ namespace jet {
 
         void search(SearchThread& st, SearchInfo& info) {
             st.start();
+            TranspositionTable.newSearch();
 
             SearchStack::List stack;
             SearchStack*      ss = SearchStack::init(stack);
@@ -433,6 +487,7 @@ namespace jet {
                     std::cout << " time " << time_elapsed;
                     std::cout << " nodes " << st.nodes;
                     std::cout << " nps " << static_cast<int>(1000.0f * st.nodes / (time_elapsed + 1));
+                    std::cout << " hashfull " << TranspositionTable.hashfull();
                     std::cout << " pv";
                     SearchStack::printPVs(ss);
 
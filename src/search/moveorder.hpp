@@ -50,12 +50,15 @@ namespace jet {
                 }
             }
 
-            static void capturesWithSee(const chess::Board& board, chess::Movelist& movelist, int threshold = 0) {
+            static void capturesWithSee(const chess::Board& board, chess::Movelist& movelist, int threshold = 0,
+                                        const chess::Move& ttMove = chess::Move::none()) {
                 for (auto& move : movelist) {
                     const auto attacker = board.pieceTypeAt(move.from());
                     const auto target   = board.pieceTypeAt(move.to());
 
-                    if (target != PieceType::NONE) {
+                    if (move == ttMove) {
+                        move.setScore(TT_MOVE_SCORE);
+                    } else if (target != PieceType::NONE) {
                         move.setScore(see(board, move, threshold) * SEE_SCORE + _mvvlva(target, attacker));
                     }
                 }
@@ -78,20 +78,9 @@ namespace jet {
                 const auto kingSqWhite = m_board.kingSq<chess::Color::WHITE>();
                 const auto kingSqBlack = m_board.kingSq<chess::Color::BLACK>();
 
-                network.push();
-
-                if (pieceType == chess::PieceType::KING &&
-                    (nnue::constants::KING_BUCKET[from ^ (static_cast<bool>(side) * 56)] != nnue::constants::KING_BUCKET[to ^ (static_cast<bool>(side) * 56)] ||
-                     static_cast<int>(from.file()) + static_cast<int>(to.file()) == 7)) {
-                    m_board.makeMove(move);
-                    refresh();
-
-                    return;
-                }
-
-                if (is_capture) {
-                    network.updateAccumulator<nnue::AccumulatorOP::SUB>(capturedType, ~side, to, kingSqWhite, kingSqBlack);
-                }
+                // Only recorded here, the accumulator is updated when the position is evaluated
+                auto& update        = network.push(kingSqWhite, kingSqBlack);
+                bool  kingRefreshes = false;
 
                 if (move.type() == chess::MoveType::CASTLING) {
                     const auto castleSide = chess::CastlingRights::getCastlingSide(move.to(), move.from());
@@ -99,39 +88,38 @@ namespace jet {
                     const auto rookTo = chess::CastlingRights::rookTo(side, castleSide);
                     const auto kingTo = chess::CastlingRights::kingTo(side, castleSide);
 
-                    if (nnue::constants::KING_BUCKET[from ^ (static_cast<bool>(side) * 56)] != nnue::constants::KING_BUCKET[kingTo ^ (static_cast<bool>(side) * 56)] ||
-                        static_cast<int>(from.file()) + static_cast<int>(kingTo.file()) == 7) {
-                        m_board.makeMove(move);
-                        refresh();
-                        return;
+                    update.sub(pieceType, side, from);
+                    update.sub(capturedType, side, to);
+                    update.add(pieceType, side, kingTo);
+                    update.add(capturedType, side, rookTo);
+
+                    kingRefreshes = changesKingInput(side, from, kingTo);
+                } else {
+                    if (is_capture) {
+                        update.sub(capturedType, ~side, to);
                     }
 
-                    network.updateAccumulator<nnue::AccumulatorOP::SUB>(pieceType, side, from, kingSqWhite, kingSqBlack);
-                    network.updateAccumulator<nnue::AccumulatorOP::SUB>(capturedType, side, to, kingSqWhite, kingSqBlack);
-                    network.updateAccumulator<nnue::AccumulatorOP::ADD>(pieceType, side, kingTo, kingSqWhite, kingSqBlack);
-                    network.updateAccumulator<nnue::AccumulatorOP::ADD>(capturedType, side, rookTo, kingSqWhite, kingSqBlack);
+                    if (move.type() == chess::MoveType::ENPASSANT) {
+                        update.sub(chess::PieceType::PAWN, ~side, chess::Square(int(move.to()) ^ 8));
+                    }
 
-                    m_board.makeMove(move);
-                    return;
-                }
+                    if (move.type() == chess::MoveType::PROMOTION) {
+                        update.sub(chess::PieceType::PAWN, side, from);
+                        update.add(move.promoted(), side, to);
+                    } else {
+                        update.sub(pieceType, side, from);
+                        update.add(pieceType, side, to);
+                    }
 
-                if (move.type() == chess::MoveType::ENPASSANT) {
-                    network.updateAccumulator<nnue::AccumulatorOP::SUB>(
-                        chess::PieceType::PAWN, ~side, chess::Square(int(move.to()) ^ 8), kingSqWhite, kingSqBlack);
+                    kingRefreshes = pieceType == chess::PieceType::KING && changesKingInput(side, from, to);
                 }
 
-                if (move.type() == chess::MoveType::PROMOTION) {
-                    network.updateAccumulator<nnue::AccumulatorOP::SUB>(chess::PieceType::PAWN, side, from, kingSqWhite,
-                                                                        kingSqBlack);
-                    network.updateAccumulator<nnue::AccumulatorOP::ADD>(move.promoted(), side, to, kingSqWhite, kingSqBlack);
+                m_board.makeMove(move);
 
-                    m_board.makeMove(move);
-                    return;
+                // The mover's perspective is rebuilt for its new king square, the other one still takes the update
+                if (kingRefreshes) {
+                    network.refresh(side, m_board);
                 }
-
-                network.updateAccumulator<nnue::AccumulatorOP::ADD_SUB>(pieceType, side, from, to, kingSqWhite, kingSqBlack);
-
-                m_board.makeMove(move);
             }
 
             template <bool updateNNUE = false>
@@ -145,31 +133,31 @@ namespace jet {
 
             int32_t eval() {
                 if (m_board.sideToMove() == chess::Color::WHITE) {
-                    return network.eval<chess::Color::WHITE>();
+                    return network.eval<chess::Color::WHITE>(m_board);
                 } else {
-                    return network.eval<chess::Color::BLACK>();
+                    return network.eval<chess::Color::BLACK>(m_board);
                 }
             }
 
             void refresh() {
-                network.resetCurrentAccumulator();
-
-                chess::Bitboard pieces = m_board.all();
-
-                const chess::Square kingSqWhite = m_board.kingSq<chess::Color::WHITE>();
-                const chess::Square kingSqBlack = m_board.kingSq<chess::Color::BLACK>();
+                network.refresh(m_board);
+            }
 
-                while (pieces.nonEmpty()) {
-                    const chess::Square sq = pieces.poplsb();
+            // Called after nnue::load(), the accumulators and refresh cache still hold the old network's values
+            void rebuildNetwork() {
+                network.rebuild();
+                refresh();
+            }
 
-                    const chess::PieceType pieceType = m_board.pieceTypeAt(sq);
-                    const chess::Color     side      = m_board.colorOf(sq);
+        private:
+            // A king move that changes bucket or crosses the mirror line changes every input of the mover's side
+            static bool changesKingInput(chess::Color side, chess::Square from, chess::Square to) {
+                const int flip = static_cast<bool>(side) * 56;
 
-                    network.updateAccumulator<nnue::AccumulatorOP::ADD>(pieceType, side, sq, kingSqWhite, kingSqBlack);
-                }
+                return nnue::constants::KING_BUCKET[from ^ flip] != nnue::constants::KING_BUCKET[to ^ flip] ||
+                       (static_cast<int>(from.file()) >= 4) != (static_cast<int>(to.file()) >= 4);
             }
 
-        private:
             chess::Board m_board;
             TimeManager  timeman;
             bool         stop_flag = false;
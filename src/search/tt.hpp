@@ -1,8 +1,16 @@
 #pragma once
 
 #include "../chess/moves.hpp"
+#include "../misc/memory.hpp"
+#include "../misc/utils.hpp"
 #include "constants.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 namespace jet {
@@ -10,94 +18,520 @@ namespace jet {
         class TT {
         public:
             using U64 = uint64_t;
+            using Key = uint16_t;
             enum class Flag : uint8_t { NONE, EXACT, LOWER, UPPER };
 
-            class Entry {
-            private:
-                types::RawMove   m_move;
-                types::Value_i16 m_score;
-                types::Depth_u8  m_depth;
-                Flag             m_flag;
-                U64              m_key;
+            // The flag lives in the low 2 bits of an entry's gen/bound byte, the search generation in the high 6 bits
+            static constexpr inline uint8_t FLAG_MASK        = 0x3;
+            static constexpr inline uint8_t GENERATION_DELTA = 0x4;
+            static constexpr inline int     GENERATION_CYCLE = 0x100 + FLAG_MASK;
+            static constexpr inline uint8_t GENERATION_MASK  = 0xFC;
+
+            // Only the low 16 bits of the hash are kept, the bucket index already covers the high bits
+            static inline Key keyFragment(U64 hash) {
+                return static_cast<Key>(hash);
+            }
 
+            // Depths are stored with an offset so a zeroed slot (depth byte 0) is always empty
+            static constexpr inline types::Depth DEPTH_OFFSET = -2;
+            static constexpr inline types::Depth DEPTH_QS     = 0;
+            static constexpr inline types::Depth DEPTH_EVAL   = -1; // entry only carries a static evaluation
+
+            class Entry {
             public:
+                // Everything but the key, packed into one 64-bit word
+                struct Data {
+                    types::RawMove   move     = 0;
+                    types::Value_i16 score    = 0;
+                    types::Value_i16 eval     = 0;
+                    types::Depth_u8  depth    = 0;
+                    uint8_t          genBound = 0;
+                };
+
                 Entry() = default;
+                Entry(Key key, Data data) : m_key(key), m_data(data) {
+                }
+
+                void set(types::RawMove move, types::Value_i16 score, types::Value_i16 eval, types::Depth depth, Flag flag,
+                         Key key, uint8_t generation) {
+                    // Keep the old move and eval if we have nothing better for the same position
+                    if (move || key != m_key) {
+                        m_data.move = move;
+                    }
 
-                void set(types::RawMove move, types::Value_i16 score, types::Depth_u8 depth, Flag flag, U64 key) {
-                    m_move  = move;
-                    m_score = score;
-                    m_depth = depth;
-                    m_flag  = flag;
-                    m_key   = key;
+                    if (eval != constants::VALUE_NONE || key != m_key) {
+                        m_data.eval = eval;
+                    }
+
+                    m_data.score    = score;
+                    m_data.depth    = static_cast<types::Depth_u8>(depth - DEPTH_OFFSET);
+                    m_data.genBound = generation | static_cast<uint8_t>(flag);
+                    m_key           = key;
                 }
 
                 auto score() const {
-                    return static_cast<types::Value>(m_score);
+                    return static_cast<types::Value>(m_data.score);
+                }
+
+                auto eval() const {
+                    return static_cast<types::Value>(m_data.eval);
                 }
 
                 auto move() const {
-                    return chess::Move(m_move);
+                    return chess::Move(m_data.move);
                 }
 
                 auto depth() const {
-                    return static_cast<types::Depth>(m_depth);
+                    return static_cast<types::Depth>(m_data.depth) + DEPTH_OFFSET;
                 }
 
                 auto flag() const {
-                    return m_flag;
+                    return static_cast<Flag>(m_data.genBound & FLAG_MASK);
+                }
+
+                auto generation() const {
+                    return static_cast<uint8_t>(m_data.genBound & GENERATION_MASK);
+                }
+
+                // Number of searches since this entry was last written
+                int age(uint8_t generation) const {
+                    return ((GENERATION_CYCLE + generation - m_data.genBound) & GENERATION_MASK) / GENERATION_DELTA;
                 }
 
                 auto key() const {
                     return m_key;
                 }
+
+                const Data& data() const {
+                    return m_data;
+                }
+
+                bool empty() const {
+                    return m_data.depth == 0;
+                }
+
+            private:
+                Key  m_key = 0;
+                Data m_data;
+            };
+
+            // A bucket never straddles a cache line, so a probe touches exactly one line
+            static constexpr inline int BUCKET_SIZE = 3;
+
+            // The data of an entry is one 64-bit word, its key is stored XORed with a fold of that word. Both are
+            // read and written with relaxed atomics, so probes and stores stay wait-free. When two threads (or
+            // processes sharing the table) race on a slot and a probe sees the key of one store next to the data of
+            // another, the key no longer matches and the torn entry reads as a miss.
+            struct alignas(32) Bucket {
+                std::array<uint64_t, BUCKET_SIZE> data;
+                std::array<Key, BUCKET_SIZE>      keys;
+
+                static Key fold(uint64_t word) {
+                    return static_cast<Key>(word ^ (word >> 16) ^ (word >> 32) ^ (word >> 48));
+                }
+
+                Entry load(int i) const {
+                    const auto word = __atomic_load_n(&data[i], __ATOMIC_RELAXED);
+                    const auto key  = __atomic_load_n(&keys[i], __ATOMIC_RELAXED);
+
+                    return Entry(key ^ fold(word), std::bit_cast<Entry::Data>(word));
+                }
+
+                void save(int i, const Entry& entry) {
+                    const auto word = std::bit_cast<uint64_t>(entry.data());
+
+                    __atomic_store_n(&data[i], word, __ATOMIC_RELAXED);
+                    __atomic_store_n(&keys[i], static_cast<Key>(entry.key() ^ fold(word)), __ATOMIC_RELAXED);
+                }
+            };
+
+            // Counters for sizing Hash per time control, only collected in `make stats` builds
+            struct Stats {
+                uint64_t probes       = 0;
+                uint64_t hits         = 0;
+                uint64_t collisions   = 0; // hits whose move is not legal in the probed position
+                uint64_t overwrites   = 0; // stores that refreshed an entry of the same position
+                uint64_t replacements = 0; // stores that evicted another position
+                uint64_t rejections   = 0; // stores dropped in favour of a deeper entry of the same position
+            };
+
+#ifdef TT_STATS
+            static constexpr inline bool STATS = true;
+#else
+            static constexpr inline bool STATS = false;
+#endif
+
+            static_assert(sizeof(Entry::Data) == sizeof(uint64_t) && std::is_trivially_copyable_v<Entry::Data>,
+                          "TT entry data must pack into a single word");
+            static_assert(sizeof(Bucket) == 32 && 64 % sizeof(Bucket) == 0, "TT bucket must fit in a cache line");
+
+            // Layout of a table dumped to disk. The header takes a whole page so the buckets that follow can be
+            // mapped straight from the file. Bump LAYOUT_VERSION whenever Entry or Bucket change. Entries cache
+            // static evals, so a file is only loaded by a process running the network it was saved with.
+            struct FileHeader {
+                static constexpr inline char     MAGIC[8]       = {'J', 'E', 'T', 'H', 'A', 'S', 'H', '\0'};
+                static constexpr inline uint32_t LAYOUT_VERSION = 2;
+                static constexpr inline size_t   SIZE           = 4096;
+
+                char     magic[8];
+                uint32_t version;
+                uint32_t bucketBytes;
+                uint64_t buckets;
+                uint8_t  generation;
+                uint64_t network; // nnue::parameters.hash, zero in files from older builds
+            };
+
+            // Header of a table shared between processes, it sits in the first page of the shared memory object
+            // with the buckets right behind it.
+            //
+            // Size negotiation: the first process to attach creates the object at its own Hash size. Every later
+            // process adopts that size and its own Hash setting has no effect while it stays attached.
+            //
+            // Cleanup: `attached` counts the processes that map the table. The last one to detach (SharedHash set
+            // back to empty, or a clean quit) removes the object. A process that is killed cannot detach, so the
+            // object outlives it with its contents and can still be attached to under the same name. As its count
+            // never drops to zero again, it then has to be removed by hand from /dev/shm.
+            //
+            // A process can open the name of a table whose count has just dropped to zero, before the last process
+            // removed it. It never joins such a table: the count only grows from a nonzero value, and otherwise the
+            // name is mapped again until it is gone or taken by a new table. A process that removes the name first
+            // checks that it still refers to the object it maps, so a table created later under the same name is
+            // never removed by the process that detached from an older one.
+            //
+            // Every attached process searches the same buckets with the usual lock-free stores. Each search start
+            // bumps the shared generation, and ucinewgame leaves a shared table alone. The cached static evals
+            // tie the table to the network of its creator, processes running another network cannot attach.
+            struct SharedHeader {
+                static constexpr inline char MAGIC[8] = {'J', 'E', 'T', 'S', 'H', 'M', '\0', '\0'};
+
+                char     magic[8];
+                uint32_t version;
+                uint32_t bucketBytes;
+                uint64_t buckets;
+                uint32_t attached;
+                uint32_t ready;
+                uint8_t  generation;
+                uint64_t network; // nnue::parameters.hash of the creator
             };
 
             class Table {
             private:
-                std::vector<Entry> m_table;
+                misc::LargePageMemory m_memory;
+                Bucket*               m_table        = nullptr;
+                size_t                m_size         = 0;
+                uint8_t               m_generation   = 0;
+                int                   m_clearThreads = 1;
+                int                   m_megabytes    = 0;
+                SharedHeader*         m_shared       = nullptr;
+                std::string           m_sharedName;
+                mutable Stats         m_stats;
 
                 static inline uint64_t _index(uint64_t x, uint64_t N) {
                     return static_cast<__uint128_t>((static_cast<__uint128_t>(x) * static_cast<__uint128_t>(N)) >> 64);
                 }
 
+                Bucket& _bucket(U64 hash) {
+                    return m_table[_index(hash, m_size)];
+                }
+
+                const Bucket& _bucket(U64 hash) const {
+                    return m_table[_index(hash, m_size)];
+                }
+
+                static size_t _buckets(int MB) {
+                    return static_cast<size_t>(MB) * 0x100000 / sizeof(Bucket);
+                }
+
+                // Drops this process from the shared table, removing it if we were the last one attached
+                void _detach();
+
+                int _worth(const Entry& entry) const {
+                    return entry.depth() - 8 * entry.age(m_generation);
+                }
+
             public:
                 Table() = default;
 
+                Table(const Table&)            = delete;
+                Table& operator=(const Table&) = delete;
+
+                ~Table() {
+                    _detach();
+                }
+
+                // Sets the table to MB megabytes. An existing table is rehashed into the new size, so changing
+                // Hash during analysis keeps what has been searched so far.
                 template <bool print = true>
                 void initialize(int MB) {
-                    resize(MB * 0x100000 / sizeof(Entry));
+                    m_megabytes = MB;
+
+                    if (m_shared) {
+                        if constexpr (print) {
+                            std::cout << "info string Hash keeps the size of shared table " << m_sharedName << std::endl;
+                        }
+                        return;
+                    }
+
+                    const size_t size     = _buckets(MB);
+                    const bool   rehashed = m_size != 0;
+                    double       elapsed  = 0;
+
+                    if (rehashed) {
+                        elapsed = rehash(size);
+                    } else {
+                        resize(size);
+                        elapsed = clear();
+                    }
 
                     if constexpr (print) {
-                        std::cout << "Transposition table initialized with " << MB << " MB ( " << m_table.size() << ") entries"
-                                  << std::endl;
+                        std::cout << "Transposition table initialized with " << MB << " MB ( " << m_size * BUCKET_SIZE
+                                  << ") entries" << std::endl;
+                        std::cout << "info string Hash uses " << misc::pageKindName(pageKind()) << std::endl;
+
+                        if (rehashed) {
+                            std::cout << "info string Hash rehashed in " << elapsed << " ms using " << m_clearThreads
+                                      << " threads" << std::endl;
+                        } else {
+                            printClearTime(elapsed);
+                        }
+                    }
+                }
+
+                void store(U64 hash, const chess::Move& move, types::Depth depth, types::Value score, types::Value eval,
+                           Flag flag) {
+                    auto&     bucket  = _bucket(hash);
+                    const Key key     = keyFragment(hash);
+                    int       replace = 0;
+                    Entry     victim  = bucket.load(0);
+
+                    // Prefer the same position, then an empty slot, then the shallowest and oldest entry
+                    for (int i = 0; i < BUCKET_SIZE; i++) {
+                        const Entry entry = bucket.load(i);
+
+                        if (entry.key() == key || entry.empty()) {
+                            replace = i;
+                            victim  = entry;
+                            break;
+                        }
+
+                        if (_worth(entry) < _worth(victim)) {
+                            replace = i;
+                            victim  = entry;
+                        }
                     }
+
+                    if (!victim.empty() && victim.key() == key) {
+                        // A much deeper result for the same position from this search is worth more than a bound,
+                        // and any deeper one is worth more than a quiescence result
+                        const bool deeper = depth == DEPTH_QS ? depth < victim.depth()
+                                                              : flag != Flag::EXACT && depth + 4 <= victim.depth();
+
+                        if (deeper && victim.age(m_generation) == 0) {
+                            if constexpr (STATS) {
+                                m_stats.rejections++;
+                            }
+                            return;
+                        }
+
+                        if constexpr (STATS) {
+                            m_stats.overwrites++;
+                        }
+                    } else if (!victim.empty()) {
+                        if constexpr (STATS) {
+                            m_stats.replacements++;
+                        }
+                    }
+
+                    victim.set(move.data(), score, eval, depth, flag, key, m_generation);
+                    bucket.save(replace, victim);
                 }
 
-                void store(U64 hash, const chess::Move& move, types::Depth depth, types::Value score, Flag flag) {
-                    auto& entry = m_table[_index(hash, m_table.size())];
-                    entry.set(move.data(), score, depth, flag, hash);
+                Entry probe(U64 hash, bool& hit) const {
+                    const auto& bucket = _bucket(hash);
+                    const Key   key    = keyFragment(hash);
+
+                    if constexpr (STATS) {
+                        m_stats.probes++;
+                    }
+
+                    for (int i = 0; i < BUCKET_SIZE; i++) {
+                        const Entry entry = bucket.load(i);
+
+                        if (entry.key() == key && !entry.empty()) {
+                            if constexpr (STATS) {
+                                m_stats.hits++;
+                            }
+
+                            hit = true;
+                            return entry;
+                        }
+                    }
+
+                    hit = false;
+                    return Entry();
                 }
 
-                const Entry& probe(U64 hash, bool& hit) const {
-                    const auto& entry = m_table[_index(hash, m_table.size())];
-                    hit               = hash == entry.key();
-                    return entry;
+                // Pull the bucket of a position we are about to visit into cache
+                void prefetch(U64 hash) const {
+                    __builtin_prefetch(&_bucket(hash));
                 }
 
+                // Called once per search so entries from earlier searches lose out on replacement
+                void newSearch() {
+                    if (m_shared) {
+                        m_generation = __atomic_add_fetch(&m_shared->generation, GENERATION_DELTA, __ATOMIC_RELAXED);
+                    } else {
+                        m_generation += GENERATION_DELTA;
+                    }
+
+                    m_stats = Stats();
+                }
+
+                // Permille of sampled entries written during the current search
+                int hashfull() const {
+                    const size_t buckets = std::min<size_t>(m_size, 1000 / BUCKET_SIZE);
+                    int          used    = 0;
+
+                    for (size_t b = 0; b < buckets; b++) {
+                        for (int i = 0; i < BUCKET_SIZE; i++) {
+                            const Entry entry = m_table[b].load(i);
+                            used += !entry.empty() && entry.age(m_generation) == 0;
+                        }
+                    }
+
+                    return buckets ? used * 1000 / static_cast<int>(buckets * BUCKET_SIZE) : 0;
+                }
+
+                void recordCollision() const {
+                    if constexpr (STATS) {
+                        m_stats.collisions++;
+                    }
+                }
+
+                void printStats() const {
+                    std::cout << "hashfull " << hashfull() << std::endl;
+
+                    if constexpr (!STATS) {
+                        std::cout << "TT counters are disabled, build with `make stats` to collect them" << std::endl;
+                        return;
+                    }
+
+                    const auto percent = [&](uint64_t n, uint64_t total) {
+                        return total ? 100.0 * n / total : 0.0;
+                    };
+
+                    const uint64_t stores = m_stats.overwrites + m_stats.replacements + m_stats.rejections;
+
+                    std::cout << "probes       " << m_stats.probes << std::endl;
+                    std::cout << "hits         " << m_stats.hits << " (" << percent(m_stats.hits, m_stats.probes) << "%)"
+                              << std::endl;
+                    std::cout << "collisions   " << m_stats.collisions << " (" << percent(m_stats.collisions, m_stats.hits)
+                              << "% of hits)" << std::endl;
+                    std::cout << "overwrites   " << m_stats.overwrites << std::endl;
+                    std::cout << "replacements " << m_stats.replacements << std::endl;
+                    std::cout << "rejections   " << m_stats.rejections << " (" << percent(m_stats.rejections, stores)
+                              << "% of non-empty stores)" << std::endl;
+                }
+
+                auto generation() const {
+                    return m_generation;
+                }
+
+                // Fresh memory comes back zeroed, which is an empty table. Its pages are only faulted in by clear(),
+                // and are interleaved over all NUMA nodes since every search thread probes the whole table
                 void resize(size_t size) {
-                    clear();
-                    m_table.resize(size);
-                    std::fill(m_table.begin(), m_table.end(), Entry());
+                    m_table = nullptr;
+                    m_size  = 0;
+
+                    if (!m_memory.allocate(size * sizeof(Bucket), misc::NumaPolicy::INTERLEAVE)) {
+                        throw std::bad_alloc();
+                    }
+
+                    m_table      = static_cast<Bucket*>(m_memory.data());
+                    m_size       = size;
+                    m_generation = 0;
                 }
 
                 auto size() const {
-                    return m_table.size();
+                    return m_size;
+                }
+
+                // Moves every entry into a fresh allocation of `size` buckets. Each new bucket keeps the most
+                // valuable entries (deepest, then newest) of the old buckets whose hashes can land in it, so
+                // shrinking drops the least useful entries. Growing spreads an old bucket over all the new
+                // buckets it may map to, as the key fragment does not tell which one the position belongs in.
+                // Threads work on disjoint ranges of new buckets. Returns the elapsed time in milliseconds.
+                double rehash(size_t size, int threads = clearThreads());
+
+                // Writes the whole table to a file, see FileHeader
+                bool save(const std::string& path) const;
+
+                // Replaces the table with a file written by save(). The file is mapped, not read, so the
+                // table is usable at once and adopts the size stored in the file.
+                bool load(const std::string& path);
+
+                // Detaches from any shared table and attaches to the one called `name`, creating it at the current
+                // Hash size if no other process has it yet. See SharedHeader for the semantics.
+                bool share(const std::string& name);
+
+                // Goes back to a private table of the configured Hash size. The shared table is removed once the
+                // last process detaches.
+                void unshare();
+
+                bool shared() const {
+                    return m_shared != nullptr;
+                }
+
+                const std::string& sharedName() const {
+                    return m_sharedName;
+                }
+
+                auto pageKind() const {
+                    return m_memory.kind();
+                }
+
+                // True if the buckets are interleaved over the NUMA nodes
+                bool numaBound() const {
+                    return m_memory.numaBound();
+                }
+
+                // Wipes every entry but keeps the current allocation. Each thread zeroes its own slice, so the
+                // pages are first touched in parallel. Returns the elapsed time in milliseconds.
+                double clear(int threads = clearThreads()) {
+                    const auto start = misc::tick();
+
+                    threads = std::max(1, std::min<int>(threads, m_size / 1024 + 1));
+
+                    std::vector<std::thread> workers;
+
+                    for (int i = 0; i < threads; i++) {
+                        const size_t begin = m_size * i / threads;
+                        const size_t end   = m_size * (i + 1) / threads;
+
+                        workers.emplace_back([this, begin, end]() {
+                            std::fill(m_table + begin, m_table + end, Bucket());
+                        });
+                    }
+
+                    for (auto& worker : workers) {
+                        worker.join();
+                    }
+
+                    m_generation = 0;
+                    m_clearThreads = threads;
+
+                    return misc::tick() - start;
+                }
+
+                static int clearThreads() {
+                    return std::max(1u, std::thread::hardware_concurrency());
                 }
 
-                void clear() {
-                    m_table.clear();
+                void printClearTime(double elapsed) const {
+                    std::cout << "info string Hash cleared in " << elapsed << " ms using " << m_clearThreads << " threads"
+                              << std::endl;
                 }
             };
         };
     } // namespace search
-} // namespace jet
\ No newline at end of file
+} // namespace jet
@@ -0,0 +1,376 @@
+#include "nnue/simd.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define JET_X86
+#    include <immintrin.h>
+#endif
+
+namespace jet {
+    namespace nnue {
+        namespace simd {
+
+            namespace {
+
+                // SIZE, the number of int16 values in one perspective, is a template parameter of every kernel so
+                // each hidden size in constants::HIDDEN_SIZES gets fully unrolled loops of its own.
+
+                template <int SIZE, typename W>
+                void addScalar(int16_t* accumulator, const W* input) {
+                    for (int i = 0; i < SIZE; ++i) {
+                        accumulator[i] += input[i];
+                    }
+                }
+
+                template <int SIZE, typename W>
+                void subScalar(int16_t* accumulator, const W* input) {
+                    for (int i = 0; i < SIZE; ++i) {
+                        accumulator[i] -= input[i];
+                    }
+                }
+
+                template <int SIZE, typename W>
+                void copyAddSubScalar(int16_t* child, const int16_t* parent, const W* add0, const W* sub0) {
+                    for (int i = 0; i < SIZE; ++i) {
+                        child[i] = parent[i] + add0[i] - sub0[i];
+                    }
+                }
+
+                template <int SIZE, typename W>
+                void copyAddSubSubScalar(int16_t* child, const int16_t* parent, const W* add0, const W* sub0,
+                                         const W* sub1) {
+                    for (int i = 0; i < SIZE; ++i) {
+                        child[i] = parent[i] + add0[i] - sub0[i] - sub1[i];
+                    }
+                }
+
+                template <int SIZE, typename W>
+                void copyAddAddSubSubScalar(int16_t* child, const int16_t* parent, const W* add0, const W* add1,
+                                            const W* sub0, const W* sub1) {
+                    for (int i = 0; i < SIZE; ++i) {
+                        child[i] = parent[i] + add0[i] + add1[i] - sub0[i] - sub1[i];
+                    }
+                }
+
+                template <constants::Activation activation>
+                int32_t activate(int16_t x, int16_t clip) {
+                    if constexpr (activation == constants::Activation::RELU) {
+                        return std::max<int32_t>(x, 0);
+                    } else if constexpr (activation == constants::Activation::CRELU) {
+                        return std::clamp<int32_t>(x, 0, clip);
+                    } else {
+                        const int32_t clipped = std::clamp<int32_t>(x, 0, clip);
+                        return clipped * clipped;
+                    }
+                }
+
+                template <int SIZE, constants::Activation activation>
+                int32_t outputScalar(const int16_t* us, const int16_t* them, const int16_t* weights, int16_t clip) {
+                    int32_t sum = 0;
+
+                    for (int i = 0; i < SIZE; ++i) {
+                        sum += activate<activation>(us[i], clip) * weights[i];
+                    }
+
+                    for (int i = 0; i < SIZE; ++i) {
+                        sum += activate<activation>(them[i], clip) * weights[SIZE + i];
+                    }
+
+                    return sum;
+                }
+
+#ifdef JET_X86
+                // Each kernel walks the row one register at a time. The loop count is a compile time constant, so
+                // the compiler fully unrolls it and nothing but the loads and stores touch memory. Rows are loaded
+                // through row##name, which widens int8 rows to int16 lanes.
+#    define JET_SIMD_KERNELS(name, features, vec, width, vload, vstore, vadd, vsub)                                    \
+        template <int SIZE, typename W>                                                                                \
+        __attribute__((target(features))) void add##name(int16_t* accumulator, const W* input) {                       \
+            for (int i = 0; i < SIZE; i += width) {                                                                    \
+                const vec a = vload(reinterpret_cast<const vec*>(accumulator + i));                                    \
+                const vec b = row##name(input + i);                                                                    \
+                vstore(reinterpret_cast<vec*>(accumulator + i), vadd(a, b));                                           \
+            }                                                                                                          \
+        }                                                                                                              \
+                                                                                                                       \
+        template <int SIZE, typename W>                                                                                \
+        __attribute__((target(features))) void sub##name(int16_t* accumulator, const W* input) {                       \
+            for (int i = 0; i < SIZE; i += width) {                                                                    \
+                const vec a = vload(reinterpret_cast<const vec*>(accumulator + i));                                    \
+                const vec b = row##name(input + i);                                                                    \
+                vstore(reinterpret_cast<vec*>(accumulator + i), vsub(a, b));                                           \
+            }                                                                                                          \
+        }                                                                                                              \
+                                                                                                                       \
+        template <int SIZE, typename W>                                                                                \
+        __attribute__((target(features))) void copyAddSub##name(int16_t* child, const int16_t* parent, const W* add0,  \
+                                                                const W* sub0) {                                       \
+            for (int i = 0; i < SIZE; i += width) {                                                                    \
+                const vec p = vload(reinterpret_cast<const vec*>(parent + i));                                         \
+                const vec a = row##name(add0 + i);                                                                     \
+                const vec s = row##name(sub0 + i);                                                                     \
+                vstore(reinterpret_cast<vec*>(child + i), vsub(vadd(p, a), s));                                        \
+            }                                                                                                          \
+        }                                                                                                              \
+                                                                                                                       \
+        template <int SIZE, typename W>                                                                                \
+        __attribute__((target(features))) void copyAddSubSub##name(int16_t* child, const int16_t* parent,              \
+                                                                   const W* add0, const W* sub0, const W* sub1) {      \
+            for (int i = 0; i < SIZE; i += width) {                                                                    \
+                const vec p  = vload(reinterpret_cast<const vec*>(parent + i));                                        \
+                const vec a  = row##name(add0 + i);                                                                    \
+                const vec s0 = row##name(sub0 + i);                                                                    \
+                const vec s1 = row##name(sub1 + i);                                                                    \
+                vstore(reinterpret_cast<vec*>(child + i), vsub(vsub(vadd(p, a), s0), s1));                             \
+            }                                                                                                          \
+        }                                                                                                              \
+                                                                                                                       \
+        template <int SIZE, typename W>                                                                                \
+        __attribute__((target(features))) void copyAddAddSubSub##name(int16_t* child, const int16_t* parent,           \
+                                                                      const W* add0, const W* add1, const W* sub0,     \
+                                                                      const W* sub1) {                                 \
+            for (int i = 0; i < SIZE; i += width) {                                                                    \
+                const vec p  = vload(reinterpret_cast<const vec*>(parent + i));                                        \
+                const vec a0 = row##name(add0 + i);                                                                    \
+                const vec a1 = row##name(add1 + i);                                                                    \
+                const vec s0 = row##name(sub0 + i);                                                                    \
+                const vec s1 = row##name(sub1 + i);                                                                    \
+                vstore(reinterpret_cast<vec*>(child + i), vsub(vsub(vadd(vadd(p, a0), a1), s0), s1));                  \
+            }                                                                                                          \
+        }
+
+                // Horizontal sums and multiply-accumulate of int16 pairs into int32 lanes, vpmaddwd or VNNI vpdpwssd
+                __attribute__((target("sse4.1"))) inline int32_t hsumSse41(__m128i v) {
+                    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+                    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+                    return _mm_cvtsi128_si32(v);
+                }
+
+                __attribute__((target("avx2"))) inline int32_t hsumAvx2(__m256i v) {
+                    return hsumSse41(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+                }
+
+                __attribute__((target("avx512f,avx512bw"))) inline int32_t hsumAvx512(__m512i v) {
+                    return _mm512_reduce_add_epi32(v);
+                }
+
+                __attribute__((target("sse4.1"))) inline __m128i dotSse41(__m128i sum, __m128i a, __m128i b) {
+                    return _mm_add_epi32(sum, _mm_madd_epi16(a, b));
+                }
+
+                __attribute__((target("avx2"))) inline __m256i dotAvx2(__m256i sum, __m256i a, __m256i b) {
+                    return _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+                }
+
+                __attribute__((target("avx512f,avx512bw"))) inline __m512i dotAvx512(__m512i sum, __m512i a,
+                                                                                     __m512i b) {
+                    return _mm512_add_epi32(sum, _mm512_madd_epi16(a, b));
+                }
+
+                __attribute__((target("avx512f,avx512bw,avx512vnni"))) inline __m512i dotVnni(__m512i sum, __m512i a,
+                                                                                              __m512i b) {
+                    return _mm512_dpwssd_epi32(sum, a, b);
+                }
+
+                // The activation is a template parameter, so each instance has no branches in its loop. SCReLU
+                // multiplies the clipped value by the weight first and then by the clipped value again through the
+                // pairwise dot product, which needs |clip * weight| to fit in int16.
+#    define JET_SIMD_OUTPUT(name, features, vec, width, vload, vzero, vset1, vmax, vmin, vmullo, vdot, vhsum)          \
+        template <int SIZE, constants::Activation activation>                                                          \
+        __attribute__((target(features))) int32_t output##name(const int16_t* us, const int16_t* them,                 \
+                                                               const int16_t* weights, int16_t clip) {                 \
+            const vec zero    = vzero();                                                                               \
+            const vec clipped = vset1(clip);                                                                           \
+            vec       sum     = vzero();                                                                               \
+                                                                                                                       \
+            for (int half = 0; half < 2; half++) {                                                                     \
+                const int16_t* input = half ? them : us;                                                               \
+                                                                                                                       \
+                for (int i = 0; i < SIZE; i += width) {                                                                \
+                    vec       v = vmax(vload(reinterpret_cast<const vec*>(input + i)), zero);                          \
+                    const vec w = vload(reinterpret_cast<const vec*>(weights + half * SIZE + i));                      \
+                                                                                                                       \
+                    if constexpr (activation != constants::Activation::RELU) {                                         \
+                        v = vmin(v, clipped);                                                                          \
+                    }                                                                                                  \
+                                                                                                                       \
+                    if constexpr (activation == constants::Activation::SCRELU) {                                       \
+                        sum = vdot(sum, vmullo(v, w), v);                                                              \
+                    } else {                                                                                           \
+                        sum = vdot(sum, v, w);                                                                         \
+                    }                                                                                                  \
+                }                                                                                                      \
+            }                                                                                                          \
+                                                                                                                       \
+            return vhsum(sum);                                                                                         \
+        }
+
+                // Feature transformer rows as int16 lanes, int8 rows are sign extended while they are loaded
+                __attribute__((target("sse4.1"))) inline __m128i rowSse41(const int16_t* row) {
+                    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+                }
+
+                __attribute__((target("sse4.1"))) inline __m128i rowSse41(const int8_t* row) {
+                    return _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row)));
+                }
+
+                __attribute__((target("avx2"))) inline __m256i rowAvx2(const int16_t* row) {
+                    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row));
+                }
+
+                __attribute__((target("avx2"))) inline __m256i rowAvx2(const int8_t* row) {
+                    return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row)));
+                }
+
+                __attribute__((target("avx512f,avx512bw"))) inline __m512i rowAvx512(const int16_t* row) {
+                    return _mm512_loadu_si512(row);
+                }
+
+                __attribute__((target("avx512f,avx512bw"))) inline __m512i rowAvx512(const int8_t* row) {
+                    return _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row)));
+                }
+
+                JET_SIMD_KERNELS(Sse41, "sse4.1", __m128i, 8, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi16,
+                                 _mm_sub_epi16)
+                JET_SIMD_KERNELS(Avx2, "avx2", __m256i, 16, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi16,
+                                 _mm256_sub_epi16)
+                JET_SIMD_KERNELS(Avx512, "avx512f,avx512bw", __m512i, 32, _mm512_loadu_si512, _mm512_storeu_si512,
+                                 _mm512_add_epi16, _mm512_sub_epi16)
+
+                JET_SIMD_OUTPUT(Sse41, "sse4.1", __m128i, 8, _mm_loadu_si128, _mm_setzero_si128, _mm_set1_epi16,
+                                _mm_max_epi16, _mm_min_epi16, _mm_mullo_epi16, dotSse41, hsumSse41)
+                JET_SIMD_OUTPUT(Avx2, "avx2", __m256i, 16, _mm256_loadu_si256, _mm256_setzero_si256, _mm256_set1_epi16,
+                                _mm256_max_epi16, _mm256_min_epi16, _mm256_mullo_epi16, dotAvx2, hsumAvx2)
+                JET_SIMD_OUTPUT(Avx512, "avx512f,avx512bw", __m512i, 32, _mm512_loadu_si512, _mm512_setzero_si512,
+                                _mm512_set1_epi16, _mm512_max_epi16, _mm512_min_epi16, _mm512_mullo_epi16, dotAvx512,
+                                hsumAvx512)
+                JET_SIMD_OUTPUT(Vnni, "avx512f,avx512bw,avx512vnni", __m512i, 32, _mm512_loadu_si512,
+                                _mm512_setzero_si512, _mm512_set1_epi16, _mm512_max_epi16, _mm512_min_epi16,
+                                _mm512_mullo_epi16, dotVnni, hsumAvx512)
+
+#    undef JET_SIMD_KERNELS
+#    undef JET_SIMD_OUTPUT
+#endif
+
+            } // namespace
+
+            // Builds a table from one set of update kernels and one set of output kernels
+#define JET_SIMD_TABLE(updates, outputs)                                                                               \
+    Kernels<Size, W> {                                                                                                 \
+        add##updates<Size, W>, sub##updates<Size, W>, copyAddSub##updates<Size, W>,                                    \
+            copyAddSubSub##updates<Size, W>, copyAddAddSubSub##updates<Size, W>,                                       \
+        {                                                                                                              \
+            output##outputs<Size, constants::Activation::RELU>, output##outputs<Size, constants::Activation::CRELU>,   \
+                output##outputs<Size, constants::Activation::SCRELU>                                                   \
+        }                                                                                                              \
+    }
+
+            Isa selected = Isa::SCALAR;
+
+            template <int Size, typename W>
+            void select(Isa isa) {
+                static_assert(Size % 32 == 0, "hidden sizes must fill whole AVX-512 registers");
+
+                switch (isa) {
+#ifdef JET_X86
+                    case Isa::AVX512VNNI:
+                        kernels<Size, W> = JET_SIMD_TABLE(Avx512, Vnni);
+                        break;
+                    case Isa::AVX512BW:
+                        kernels<Size, W> = JET_SIMD_TABLE(Avx512, Avx512);
+                        break;
+                    case Isa::AVX2:
+                        kernels<Size, W> = JET_SIMD_TABLE(Avx2, Avx2);
+                        break;
+                    case Isa::SSE41:
+                        kernels<Size, W> = JET_SIMD_TABLE(Sse41, Sse41);
+                        break;
+#endif
+                    default:
+                        kernels<Size, W> = JET_SIMD_TABLE(Scalar, Scalar);
+                        break;
+                }
+            }
+
+#undef JET_SIMD_TABLE
+
+            Isa detect() {
+#ifdef JET_X86
+                // The builtins run cpuid and also check via xgetbv that the OS saves the wide registers
+                __builtin_cpu_init();
+
+                if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+                    return Isa::AVX512VNNI;
+                }
+
+                if (__builtin_cpu_supports("avx512bw")) {
+                    return Isa::AVX512BW;
+                }
+
+                if (__builtin_cpu_supports("avx2")) {
+                    return Isa::AVX2;
+                }
+
+                if (__builtin_cpu_supports("sse4.1")) {
+                    return Isa::SSE41;
+                }
+#endif
+                return Isa::SCALAR;
+            }
+
+            void init() {
+                use(detect());
+            }
+
+            void use(Isa isa) {
+                selected = isa;
+
+                // Keep in sync with constants::HIDDEN_SIZES and constants::WeightType
+                select<256, int16_t>(isa);
+                select<512, int16_t>(isa);
+                select<768, int16_t>(isa);
+                select<256, int8_t>(isa);
+                select<512, int8_t>(isa);
+                select<768, int8_t>(isa);
+            }
+
+            const char* isaName(Isa isa) {
+                switch (isa) {
+                    case Isa::AVX512VNNI:
+                        return "AVX-512VNNI";
+                    case Isa::AVX512BW:
+                        return "AVX-512BW";
+                    case Isa::AVX2:
+                        return "AVX2";
+                    case Isa::SSE41:
+                        return "SSE4.1";
+                    default:
+                        return "scalar";
+                }
+            }
+
+            bool fitsScrelu(const int16_t* weights, size_t count, int16_t clip) {
+                return std::all_of(weights, weights + count, [clip](int16_t weight) {
+                    return std::abs(static_cast<int32_t>(weight) * clip) <= INT16_MAX;
+                });
+            }
+
+            size_t vectorBytes(Isa isa) {
+                switch (isa) {
+                    case Isa::AVX512VNNI:
+                    case Isa::AVX512BW:
+                        return 64;
+                    case Isa::AVX2:
+                        return 32;
+                    case Isa::SSE41:
+                        return 16;
+                    default:
+                        return alignof(int32_t);
+                }
+            }
+
+        } // namespace simd
+    } // namespace nnue
+} // namespace jet
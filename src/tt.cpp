@@ -0,0 +1,284 @@
+#include "search/tt.hpp"
+#include "nnue/nnue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+namespace jet {
+    namespace search {
+
+        bool TT::Table::save(const std::string& path) const {
+            std::ofstream file(path, std::ios::binary);
+
+            if (!file) {
+                return false;
+            }
+
+            FileHeader header{};
+            std::memcpy(header.magic, FileHeader::MAGIC, sizeof(header.magic));
+            header.version     = FileHeader::LAYOUT_VERSION;
+            header.bucketBytes = sizeof(Bucket);
+            header.buckets     = m_size;
+            header.generation  = m_generation;
+            header.network     = nnue::parameters.hash;
+
+            std::array<char, FileHeader::SIZE> page{};
+            std::memcpy(page.data(), &header, sizeof(header));
+
+            file.write(page.data(), page.size());
+            file.write(reinterpret_cast<const char*>(m_table), m_size * sizeof(Bucket));
+
+            return static_cast<bool>(file);
+        }
+
+        bool TT::Table::load(const std::string& path) {
+            if (m_shared) {
+                std::cout << "info string Cannot load into shared table " << m_sharedName << std::endl;
+                return false;
+            }
+
+            misc::LargePageMemory memory;
+
+            if (!memory.mapFile(path.c_str())) {
+                std::cout << "info string Could not open " << path << std::endl;
+                return false;
+            }
+
+            FileHeader header;
+
+            if (memory.size() < FileHeader::SIZE) {
+                std::cout << "info string " << path << " is not a hash file" << std::endl;
+                return false;
+            }
+
+            std::memcpy(&header, memory.data(), sizeof(header));
+
+            if (std::memcmp(header.magic, FileHeader::MAGIC, sizeof(header.magic)) != 0) {
+                std::cout << "info string " << path << " is not a hash file" << std::endl;
+                return false;
+            }
+
+            if (header.version != FileHeader::LAYOUT_VERSION || header.bucketBytes != sizeof(Bucket)) {
+                std::cout << "info string " << path << " has entry layout version " << header.version << ", expected "
+                          << FileHeader::LAYOUT_VERSION << std::endl;
+                return false;
+            }
+
+            // Divided rather than multiplied, a damaged bucket count must not wrap around to a small size
+            if (header.buckets == 0 || header.buckets > (memory.size() - FileHeader::SIZE) / sizeof(Bucket)) {
+                std::cout << "info string " << path << " is truncated" << std::endl;
+                return false;
+            }
+
+            if (header.network != nnue::parameters.hash) {
+                std::cout << "info string " << path << " was saved with a different network, its evals do not apply"
+                          << std::endl;
+                return false;
+            }
+
+            m_memory     = std::move(memory);
+            m_table      = reinterpret_cast<Bucket*>(static_cast<char*>(m_memory.data()) + FileHeader::SIZE);
+            m_size       = header.buckets;
+            m_generation = header.generation;
+
+            return true;
+        }
+
+        bool TT::Table::share(const std::string& name) {
+            if (name.empty() || name.find('/') != std::string::npos) {
+                std::cout << "info string Shared table names cannot be empty or contain '/'" << std::endl;
+                return false;
+            }
+
+            const std::string     object  = "/jet-" + name;
+            const size_t          size    = std::max<size_t>(1, _buckets(m_megabytes));
+            misc::LargePageMemory memory;
+            SharedHeader*         header  = nullptr;
+            bool                  created = false;
+
+            for (int retries = 0;; retries++) {
+                if (!memory.mapShared(object.c_str(), FileHeader::SIZE + size * sizeof(Bucket), created)) {
+                    std::cout << "info string Could not map shared memory " << object << std::endl;
+                    return false;
+                }
+
+                header = static_cast<SharedHeader*>(memory.data());
+
+                if (created) {
+                    std::memcpy(header->magic, SharedHeader::MAGIC, sizeof(header->magic));
+                    header->version     = FileHeader::LAYOUT_VERSION;
+                    header->bucketBytes = sizeof(Bucket);
+                    header->buckets     = size;
+                    header->network     = nnue::parameters.hash;
+                    header->attached    = 1;
+                    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+                    break;
+                }
+
+                // The creator fills in the header right after sizing the object
+                for (int tries = 0; !__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) && tries < 1000; tries++) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+
+                // The bucket count is divided rather than multiplied, so a damaged one cannot wrap around
+                if (!header->ready || std::memcmp(header->magic, SharedHeader::MAGIC, sizeof(header->magic)) != 0 ||
+                    header->version != FileHeader::LAYOUT_VERSION || header->bucketBytes != sizeof(Bucket) ||
+                    memory.size() < FileHeader::SIZE || header->buckets == 0 ||
+                    header->buckets > (memory.size() - FileHeader::SIZE) / sizeof(Bucket)) {
+                    std::cout << "info string " << object << " is not a compatible shared table" << std::endl;
+                    return false;
+                }
+
+                if (header->network != nnue::parameters.hash) {
+                    std::cout << "info string " << object << " was created with a different network" << std::endl;
+                    return false;
+                }
+
+                // Only join a table that still has processes. A count of zero means its last process has
+                // detached and is about to remove the name, so map the name again once that happened.
+                uint32_t attached = __atomic_load_n(&header->attached, __ATOMIC_ACQUIRE);
+
+                while (attached != 0 && !__atomic_compare_exchange_n(&header->attached, &attached, attached + 1, false,
+                                                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                }
+
+                if (attached != 0) {
+                    break;
+                }
+
+                if (retries == 1000) {
+                    std::cout << "info string " << object << " is being removed, try again" << std::endl;
+                    return false;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            // Attach before detaching, so sharing the same name again never drops the count to zero
+            _detach();
+
+            m_memory     = std::move(memory);
+            m_table      = reinterpret_cast<Bucket*>(static_cast<char*>(m_memory.data()) + FileHeader::SIZE);
+            m_size       = header->buckets;
+            m_generation = __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+            m_shared     = header;
+            m_sharedName = name;
+
+            return true;
+        }
+
+        void TT::Table::_detach() {
+            if (!m_shared) {
+                return;
+            }
+
+            if (__atomic_sub_fetch(&m_shared->attached, 1, __ATOMIC_ACQ_REL) == 0) {
+                m_memory.unlinkShared(("/jet-" + m_sharedName).c_str());
+            }
+
+            m_memory.release();
+            m_table  = nullptr;
+            m_size   = 0;
+            m_shared = nullptr;
+            m_sharedName.clear();
+        }
+
+        void TT::Table::unshare() {
+            if (!m_shared) {
+                return;
+            }
+
+            _detach();
+
+            if (m_megabytes) {
+                resize(_buckets(m_megabytes));
+                clear();
+            }
+        }
+
+        double TT::Table::rehash(size_t size, int threads) {
+            const auto start = misc::tick();
+
+            misc::LargePageMemory memory;
+
+            if (!memory.allocate(size * sizeof(Bucket), misc::NumaPolicy::INTERLEAVE)) {
+                throw std::bad_alloc();
+            }
+
+            Bucket* const table   = static_cast<Bucket*>(memory.data());
+            const size_t  oldSize = m_size;
+
+            // Hashes of new bucket j fall in [j, j + 1) * 2^64 / size, which covers the old buckets
+            // [j * oldSize / size, ((j + 1) * oldSize - 1) / size]
+            const auto rehashRange = [&](size_t begin, size_t end) {
+                for (size_t j = begin; j < end; j++) {
+                    const size_t first = static_cast<__uint128_t>(j) * oldSize / size;
+                    const size_t last  = (static_cast<__uint128_t>(j + 1) * oldSize - 1) / size;
+
+                    std::array<Entry, BUCKET_SIZE> kept{};
+
+                    for (size_t i = first; i <= last && i < oldSize; i++) {
+                        for (int k = 0; k < BUCKET_SIZE; k++) {
+                            const Entry entry = m_table[i].load(k);
+
+                            if (entry.empty()) {
+                                continue;
+                            }
+
+                            // Growing and shrinking again copies an entry into the same bucket more than once,
+                            // so only the best entry of a key is kept
+                            const auto same = std::find_if(kept.begin(), kept.end(), [&](const Entry& other) {
+                                return !other.empty() && other.key() == entry.key();
+                            });
+
+                            if (same != kept.end()) {
+                                if (_worth(*same) >= _worth(entry)) {
+                                    continue;
+                                }
+
+                                std::move(same + 1, kept.end(), same);
+                                kept.back() = Entry();
+                            }
+
+                            // Keep the most valuable entries, sorted from best to worst
+                            const auto slot = std::find_if(kept.begin(), kept.end(), [&](const Entry& other) {
+                                return other.empty() || _worth(other) < _worth(entry);
+                            });
+
+                            if (slot != kept.end()) {
+                                std::move_backward(slot, kept.end() - 1, kept.end());
+                                *slot = entry;
+                            }
+                        }
+                    }
+
+                    for (int k = 0; k < BUCKET_SIZE; k++) {
+                        table[j].save(k, kept[k]);
+                    }
+                }
+            };
+
+            threads = std::max(1, std::min<int>(threads, size / 1024 + 1));
+
+            std::vector<std::thread> workers;
+
+            for (int i = 0; i < threads; i++) {
+                workers.emplace_back(rehashRange, size * i / threads, size * (i + 1) / threads);
+            }
+
+            for (auto& worker : workers) {
+                worker.join();
+            }
+
+            m_memory       = std::move(memory);
+            m_table        = table;
+            m_size         = size;
+            m_clearThreads = threads;
+
+            return misc::tick() - start;
+        }
+
+    } // namespace search
+} // namespace jet